@@ -34,9 +34,12 @@
 #include <QtNetwork/QNetworkProxyFactory>
 
 #include <qt_windows.h>
+#include <psapi.h>
 #include <userenv.h>
 #include <wtsapi32.h>
 
+#include <utility>
+
 using namespace Qt::StringLiterals;
 
 int main( int argc, char *argv[] )
@@ -53,29 +56,13 @@ Application::Application( int &argc, char **argv )
 	if( log.exists() && log.open( QFile::WriteOnly|QFile::Append ) )
 		qInstallMessageHandler( msgHandler );
 
-	QTranslator *qt = new QTranslator( this );
-	QTranslator *t = new QTranslator( this );
-	QString lang;
-	auto languages = QLocale().uiLanguages().first();
-	if(languages.contains("et"_L1, Qt::CaseInsensitive))
-		lang = u"et"_s;
-	else if(languages.contains("ru"_L1, Qt::CaseInsensitive))
-		lang = u"ru"_s;
-	else
-		lang = u"en"_s;
-	void(qt->load(":/qtbase_%1.qm"_L1.arg(lang)));
-	void(t->load(":/idupdater_%1.qm"_L1.arg(lang)));
-	installTranslator( qt );
-	installTranslator( t );
 #ifdef NDEBUG
 	setLibraryPaths({ applicationDirPath() });
 #endif
-	setWindowIcon(QIcon(u":/appicon.png"_s));
 	setApplicationName(u"id-updater"_s);
 	setApplicationVersion(u"" VERSION ""_s);
 	setOrganizationDomain(u"ria.ee"_s);
 	setOrganizationName(u"RIA"_s);
-	setStyle(u"windowsvista"_s);
 	QNetworkProxyFactory::setUseSystemConfiguration(true);
 }
 
@@ -101,6 +88,44 @@ int Application::confTask( const QStringList &args ) const
 	return true;
 }
 
+void Application::loadUi()
+{
+	// Translations, style plugin and icon are needed only when a window is shown,
+	// scheduled runs without updates never load them
+	static bool loaded = false;
+	if(std::exchange(loaded, true))
+		return;
+	QTranslator *qt = new QTranslator( qApp );
+	QTranslator *t = new QTranslator( qApp );
+	QString lang;
+	auto languages = QLocale().uiLanguages().first();
+	if(languages.contains("et"_L1, Qt::CaseInsensitive))
+		lang = u"et"_s;
+	else if(languages.contains("ru"_L1, Qt::CaseInsensitive))
+		lang = u"ru"_s;
+	else
+		lang = u"en"_s;
+	void(qt->load(":/qtbase_%1.qm"_L1.arg(lang)));
+	void(t->load(":/idupdater_%1.qm"_L1.arg(lang)));
+	installTranslator( qt );
+	installTranslator( t );
+	setWindowIcon(QIcon(u":/appicon.png"_s));
+	setStyle(u"windowsvista"_s);
+	logMemory("ui");
+}
+
+void Application::logMemory(const char *phase)
+{
+	PROCESS_MEMORY_COUNTERS_EX counters { sizeof(counters) };
+	if(!GetProcessMemoryInfo(GetCurrentProcess(), PPROCESS_MEMORY_COUNTERS(&counters), sizeof(counters)))
+		return;
+	static const qint64 budget = QSettings().value(u"MemoryBudget"_s, 64).toLongLong() * 1024 * 1024;
+	qDebug() << "Memory" << phase << "working set" << counters.WorkingSetSize / 1024 << "KiB peak"
+		<< counters.PeakWorkingSetSize / 1024 << "KiB private" << counters.PrivateUsage / 1024 << "KiB";
+	if(qint64(counters.PrivateUsage) > budget)
+		qWarning() << "Memory budget of" << budget / 1024 << "KiB exceeded in" << phase << "phase";
+}
+
 bool Application::execute(const QStringList &arguments)
 {
 	// http://www.codeproject.com/KB/vista-security/interaction-in-vista.aspx
@@ -161,7 +186,7 @@ bool Application::execute(const QStringList &arguments)
 
 void Application::messageReceived( const QString &str )
 {
-	w->checkUpdates(str.contains("-autoupdate"_L1), str.contains("-autoclose"_L1));
+	w->checkUpdates(str.contains("-autoupdate"_L1), str.contains("-autoclose"_L1), str.contains("-prestage"_L1));
 }
 
 void Application::msgHandler( QtMsgType type, const QMessageLogContext &, const QString &msg )
@@ -180,16 +205,21 @@ void Application::msgHandler( QtMsgType type, const QMessageLogContext &, const
 
 void Application::printHelp()
 {
+	loadUi();
 	QMessageBox::information(nullptr, u"ID Updater"_s,
 		"<table><tr><td>-help</td><td>%1</td></tr>"
 		"<tr><td>-autoupdate</td><td>%2</td></tr>"
 		"<tr><td>-autoclose</td><td>%3</td></tr>"
-		"<tr><td>-task</td><td>%4</td></tr>"
+		"<tr><td>-prestage</td><td>%4</td></tr>"
+		"<tr><td>-source &lt;path&gt;</td><td>%5</td></tr>"
+		"<tr><td>-task</td><td>%6</td></tr>"
 		"<tr><td colspan=\"2\">-daily|-monthly|-weekly|-remove</td></tr>"
-		"<tr><td colspan=\"2\">%6</td></tr></table>"_L1.arg(
+		"<tr><td colspan=\"2\">%7</td></tr></table>"_L1.arg(
 		tr("this help"),
 		tr("update automatically"),
 		tr("close automatically when no updates are available"),
+		tr("download and verify available update in background"),
+		tr("use exported update repository directory or file/smb URL"),
 		tr("execute subprocess to right window session under windows"),
 		tr("configure scheduled task to run at given interval, or remove it")));
 }
@@ -208,8 +238,11 @@ int Application::run()
 	{
 		int result = confTask( args );
 		if( !result )
+		{
+			loadUi();
 			QMessageBox::warning(nullptr, u"ID Updater"_s,
 				tr("Failed to set schedule, check permissions. Try again with administrator permissions.") );
+		}
 		return !result;
 	}
 
@@ -228,7 +261,9 @@ int Application::run()
 	connect( this, &QtSingleApplication::messageReceived, this, &Application::messageReceived );
 
 	w = new idupdater( this );
-	w->checkUpdates(args.contains("-autoupdate"_L1), args.contains("-autoclose"_L1));
+	if(qsizetype i = args.indexOf("-source"_L1); i >= 0 && i + 1 < args.size())
+		w->setSource(args.at(i + 1));
+	w->checkUpdates(args.contains("-autoupdate"_L1), args.contains("-autoclose"_L1), args.contains("-prestage"_L1));
 
 	return exec();
 }
@@ -34,6 +34,9 @@ public:
 
 	int run();
 
+	static void loadUi();
+	static void logMemory(const char *phase);
+
 private:
 	bool execute(const QStringList &arguments);
 	void messageReceived( const QString &str );
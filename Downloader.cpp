@@ -0,0 +1,436 @@
+/*
+ * id-updater
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "Downloader.h"
+
+#include <QDebug>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QSettings>
+#include <QTimer>
+
+#include <algorithm>
+#include <limits>
+#include <utility>
+
+using namespace Qt::StringLiterals;
+using namespace std::chrono_literals;
+
+constexpr auto PROBE_TIMEOUT = 5s;
+constexpr auto STALL_TIMEOUT = 30s;
+constexpr auto THROTTLE_INTERVAL = 100ms;
+constexpr int MAX_ROUNDS = 2;
+constexpr qsizetype BUFFER_SIZE = 64 * 1024;
+constexpr qint64 MAX_BUFFERED = 1024 * 1024;
+
+// Buffers are reused by following downloads of the same thread, e.g. component packages
+static thread_local QList<QByteArray> bufferPool;
+
+static QByteArray acquireBuffer()
+{
+	return bufferPool.isEmpty() ? QByteArray(BUFFER_SIZE, Qt::Uninitialized) : bufferPool.takeLast();
+}
+
+static void releaseBuffer(QByteArray &buffer)
+{
+	if(!buffer.isEmpty())
+		bufferPool.append(std::exchange(buffer, {}));
+}
+
+Downloader::Downloader(QNetworkAccessManager *manager, const QNetworkRequest &request,
+		const QList<QUrl> &urls, QObject *parent)
+	: QObject(parent)
+	, manager(manager)
+	, request(request)
+	, chunk(acquireBuffer())
+{
+	for(const QUrl &url: urls)
+	{
+		if(url.isValid())
+			mirrors.append({url});
+	}
+}
+
+Downloader::Downloader(QNetworkAccessManager *manager, const QNetworkRequest &request,
+		const UpdaterConfig::Package &package, QObject *parent)
+	: Downloader(manager, request, package.compressed.isEmpty() ? package.mirrors : package.compressed, parent)
+{
+	if(package.compressed.isEmpty())
+		return setChecksum(package.checksum);
+	setCompressed(package.compressedHash);
+	// Plain package is used when none of the compressed variants can be downloaded or inflated
+	for(const QUrl &url: package.mirrors)
+	{
+		if(url.isValid())
+			uncompressed.append({url});
+	}
+	uncompressedChecksum = package.checksum;
+}
+
+Downloader::~Downloader()
+{
+	if(compressed)
+		inflateEnd(&zs);
+	releaseBuffer(buffer);
+	releaseBuffer(chunk);
+}
+
+QString Downloader::fileName() const
+{
+	return file.fileName();
+}
+
+void Downloader::setChecksum(const QByteArray &sha256)
+{
+	checksum = sha256;
+}
+
+void Downloader::setCompressed(const QByteArray &sha256)
+{
+	if(compressed)
+		return;
+	// Accept both gzip and zlib headers
+	compressed = inflateInit2(&zs, MAX_WBITS + 32) == Z_OK;
+	checksum = sha256;
+	buffer = acquireBuffer();
+}
+
+void Downloader::setPersistentStats(bool persistent)
+{
+	persistentStats = persistent;
+}
+
+void Downloader::setRateLimit(qint64 bytesPerSecond)
+{
+	rateLimit = bytesPerSecond;
+	tokens = 0;
+	rateTimer.start();
+}
+
+void Downloader::start(const QString &filePath)
+{
+	file.setFileName(filePath);
+	if(!file.open(QFile::WriteOnly|QFile::Truncate))
+		return emit finished(file.errorString());
+	if(mirrors.isEmpty())
+		return emit finished(tr("Download address is missing"));
+	if(mirrors.size() == 1)
+		return download();
+	probe();
+}
+
+void Downloader::probe()
+{
+	probing = int(mirrors.size());
+	for(qsizetype i = 0; i < mirrors.size(); ++i)
+	{
+		QNetworkRequest req = request;
+		req.setUrl(mirrors.at(i).url);
+		req.setTransferTimeout(PROBE_TIMEOUT);
+		QElapsedTimer timer;
+		timer.start();
+		QNetworkReply *reply = manager->head(req);
+		connect(reply, &QNetworkReply::finished, this, [this, reply, i, timer] {
+			Mirror &m = mirrors[i];
+			if(reply->error() == QNetworkReply::NoError)
+			{
+				m.rtt = timer.elapsed();
+				m.size = reply->header(QNetworkRequest::ContentLengthHeader).toLongLong();
+				m.ranges = reply->rawHeader("Accept-Ranges") == "bytes";
+			}
+			m.score = score(m);
+			qDebug() << "Probe" << m.url.toString() << "RTT" << m.rtt << "size" << m.size << "ranges" << m.ranges;
+			updateStats(m.url, m.rtt);
+			reply->deleteLater();
+			if(--probing > 0)
+				return;
+			std::stable_sort(mirrors.begin(), mirrors.end(), [](const Mirror &l, const Mirror &r) {
+				return l.score < r.score;
+			});
+			download();
+		});
+	}
+}
+
+void Downloader::copy(const QString &filePath)
+{
+	// Local files are accepted only with a checksum from the repository index or config
+	if(checksum.isEmpty())
+		return finish(tr("Downloaded file checksum does not match"));
+	reset();
+	QFile source(filePath);
+	const uchar *data = source.open(QFile::ReadOnly) ? source.map(0, source.size()) : nullptr;
+	if(!data && source.size() > 0)
+		return finish(source.errorString());
+	qDebug() << "Copying" << filePath;
+	if(!write(QByteArray::fromRawData((const char*)data, source.size())))
+		return finish(failure);
+	emit downloadProgress(received, received);
+	finish(verify() ? QString() : tr("Downloaded file checksum does not match"));
+}
+
+void Downloader::download()
+{
+	const Mirror &m = mirrors.at(current);
+	if(m.url.isLocalFile())
+		return copy(m.url.toLocalFile());
+	QNetworkRequest req = request;
+	req.setUrl(m.url);
+	req.setTransferTimeout(STALL_TIMEOUT);
+	// Packages are binary or already compressed, ranges must address the bytes as stored on the mirror
+	req.setRawHeader("Accept-Encoding", "identity");
+	// Keep the bytes already received only when the mirror serves the same file size with range
+	// support, the final content is still covered by the package signature check
+	qint64 offset = received;
+	if(offset > 0 && m.ranges && size > 0 && m.size == size)
+		req.setRawHeader("Range", "bytes=%1-"_L1.arg(offset).toLatin1());
+	else
+		offset = 0;
+	if(offset == 0)
+		reset();
+	qDebug() << "Downloading" << m.url.toString() << "from offset" << offset;
+	accepted = false;
+	throttling = false;
+	rejected.clear();
+
+	QNetworkReply *reply = manager->get(req);
+	// Bound memory when disk is slower than network, data is drained to the file on each readyRead.
+	// Rate limited downloads keep the buffer small, so TCP flow control slows down the sender.
+	reply->setReadBufferSize(rateLimit > 0 ? BUFFER_SIZE : MAX_BUFFERED);
+	connect(reply, &QNetworkReply::metaDataChanged, this, [this, reply, i = current, offset] {
+		int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+		// Redirects are followed, wait for the final response
+		if(status >= 300 && status < 400)
+			return;
+		Mirror &m = mirrors[i];
+		if(status == 200)
+		{
+			if(offset > 0)
+				qDebug() << "Mirror ignored range request, restarting from beginning";
+			m.ranges = reply->rawHeader("Accept-Ranges") == "bytes";
+			m.size = reply->header(QNetworkRequest::ContentLengthHeader).toLongLong();
+			size = m.size;
+			reset();
+			accepted = true;
+			return;
+		}
+		// Partial content must continue exactly where the previous mirror stopped
+		QByteArray range = reply->rawHeader("Content-Range");
+		accepted = status == 206 && offset > 0 &&
+			range.startsWith("bytes %1-"_L1.arg(offset).toLatin1()) &&
+			range.endsWith("/%1"_L1.arg(size).toLatin1());
+		if(accepted)
+			return;
+		// Error pages and unexpected ranges are never written to the file or the checksum
+		qWarning() << "Mirror" << m.url.toString() << "responded with status" << status << range;
+		rejected = tr("Download server responded with status %1").arg(status);
+		reply->abort();
+	});
+	connect(reply, &QNetworkReply::readyRead, this, [this, reply] {
+		if(!read(reply))
+			reply->abort();
+	});
+	connect(reply, &QNetworkReply::downloadProgress, this, [this](qint64 /*recvd*/, qint64 total) {
+		emit downloadProgress(received, size > 0 ? size : total);
+	});
+	connect(reply, &QNetworkReply::finished, this, [this, reply] {
+		reply->deleteLater();
+		if(!failure.isEmpty())
+			return fail(failure);
+		QString err = rejected.isEmpty() ? reply->errorString() : rejected;
+		if(reply->error() == QNetworkReply::NoError && accepted)
+		{
+			if(!read(reply, false))
+				return fail(failure);
+			if(verify())
+				return finish({});
+			err = tr("Downloaded file checksum does not match");
+			reset();
+		}
+		// Keep the bytes that arrived before the connection failed, next mirror resumes after them
+		else if(accepted && !read(reply, false))
+			return fail(failure);
+		qWarning() << "Download from" << reply->url().toString() << "failed:" << err;
+		updateStats(reply->url(), -1);
+		if(++attempts < mirrors.size() * MAX_ROUNDS)
+		{
+			current = (current + 1) % mirrors.size();
+			return download();
+		}
+		fail(err);
+	});
+}
+
+void Downloader::fail(const QString &error)
+{
+	if(!compressed || uncompressed.isEmpty())
+		return finish(error);
+	qWarning() << "Compressed download failed:" << error << "falling back to uncompressed package";
+	inflateEnd(&zs);
+	compressed = false;
+	releaseBuffer(buffer);
+	mirrors = std::exchange(uncompressed, {});
+	checksum = std::exchange(uncompressedChecksum, {});
+	failure.clear();
+	current = 0;
+	attempts = 0;
+	received = 0;
+	size = -1;
+	if(mirrors.size() == 1)
+		return download();
+	probe();
+}
+
+void Downloader::finish(const QString &error)
+{
+	if(compressed && received > 0)
+		qDebug() << "Inflated" << received << "bytes to" << file.size() << "bytes, saved"
+			<< file.size() - received << "bytes, inflate took" << inflateTime / 1000000 << "ms";
+	file.close();
+	emit finished(error);
+}
+
+bool Downloader::read(QNetworkReply *reply, bool throttle)
+{
+	throttle = throttle && rateLimit > 0;
+	qint64 budget = std::numeric_limits<qint64>::max();
+	if(throttle)
+	{
+		// Token bucket allowing at most one second of burst
+		tokens = std::min(rateLimit, tokens + rateLimit * rateTimer.restart() / 1000);
+		budget = tokens;
+	}
+	for(qint64 len = 0; budget > 0 && (len = reply->read(chunk.data(), std::min<qint64>(chunk.size(), budget))) > 0;)
+	{
+		if(throttle)
+			budget -= len;
+		// Drain bodies of responses that were not accepted
+		if(accepted && !write(QByteArrayView(chunk.constData(), len)))
+			return false;
+	}
+	if(!throttle)
+		return true;
+	tokens = budget;
+	// Data left in the reply waits for the next allowance, no readyRead follows while the buffer is full
+	if(reply->bytesAvailable() > 0 && !throttling)
+	{
+		throttling = true;
+		QTimer::singleShot(THROTTLE_INTERVAL, reply, [this, reply] {
+			throttling = false;
+			if(!read(reply))
+				reply->abort();
+		});
+	}
+	return true;
+}
+
+void Downloader::reset()
+{
+	received = 0;
+	hash.reset();
+	if(compressed)
+		inflateReset(&zs);
+	zstatus = Z_OK;
+	file.resize(0);
+	file.seek(0);
+}
+
+bool Downloader::verify() const
+{
+	if(compressed && zstatus != Z_STREAM_END)
+		return false;
+	return checksum.isEmpty() || hash.result() == checksum;
+}
+
+bool Downloader::write(QByteArrayView data)
+{
+	received += data.size();
+	if(!checksum.isEmpty())
+		hash.addData(data);
+	if(!compressed)
+	{
+		if(file.write(data.data(), data.size()) == data.size())
+			return true;
+		failure = file.errorString();
+		return false;
+	}
+
+	if(zstatus == Z_STREAM_END)
+		return true;
+	QElapsedTimer timer;
+	timer.start();
+	zs.next_in = (Bytef*)data.data();
+	zs.avail_in = uInt(data.size());
+	do
+	{
+		zs.next_out = (Bytef*)buffer.data();
+		zs.avail_out = uInt(buffer.size());
+		zstatus = inflate(&zs, Z_NO_FLUSH);
+		if(zstatus != Z_OK && zstatus != Z_STREAM_END && zstatus != Z_BUF_ERROR)
+		{
+			failure = tr("Failed to decompress downloaded file");
+			return false;
+		}
+		qint64 len = buffer.size() - zs.avail_out;
+		if(file.write(buffer.constData(), len) != len)
+		{
+			failure = file.errorString();
+			return false;
+		}
+	} while((zs.avail_in > 0 || zs.avail_out == 0) && zstatus != Z_STREAM_END);
+	inflateTime += timer.nsecsElapsed();
+	return true;
+}
+
+qint64 Downloader::score(const Mirror &mirror) const
+{
+	if(mirror.rtt < 0)
+		return std::numeric_limits<qint64>::max();
+	Stats stats = loadStats(mirror.url.host());
+	qint64 avg = stats.rtt < 0 ? mirror.rtt : stats.rtt;
+	return (mirror.rtt + avg) / 2 + stats.failures * std::chrono::milliseconds(PROBE_TIMEOUT).count();
+}
+
+Downloader::Stats Downloader::loadStats(const QString &host) const
+{
+	if(!persistentStats)
+		return memoryStats.value(host);
+	QSettings s;
+	s.beginGroup("Mirrors/"_L1 + host);
+	return {s.value("RTT"_L1, -1).toLongLong(), s.value("Failures"_L1, 0).toInt()};
+}
+
+void Downloader::updateStats(const QUrl &url, qint64 rtt)
+{
+	Stats stats = loadStats(url.host());
+	if(rtt < 0)
+		++stats.failures;
+	else
+	{
+		stats.rtt = stats.rtt < 0 ? rtt : (stats.rtt * 3 + rtt) / 4;
+		stats.failures = std::max(0, stats.failures - 1);
+	}
+	if(!persistentStats)
+		return void(memoryStats.insert(url.host(), stats));
+	QSettings s;
+	s.beginGroup("Mirrors/"_L1 + url.host());
+	if(stats.rtt >= 0)
+		s.setValue("RTT"_L1, stats.rtt);
+	s.setValue("Failures"_L1, stats.failures);
+}
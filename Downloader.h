@@ -0,0 +1,104 @@
+/*
+ * id-updater
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#pragma once
+
+#include "UpdaterConfig.h"
+
+#include <QCryptographicHash>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
+#include <QNetworkRequest>
+#include <QUrl>
+
+#include <limits>
+
+#include <zlib.h>
+
+class QNetworkAccessManager;
+class QNetworkReply;
+
+class Downloader: public QObject
+{
+	Q_OBJECT
+public:
+	explicit Downloader(QNetworkAccessManager *manager, const QNetworkRequest &request,
+		const QList<QUrl> &urls, QObject *parent = nullptr);
+	explicit Downloader(QNetworkAccessManager *manager, const QNetworkRequest &request,
+		const UpdaterConfig::Package &package, QObject *parent = nullptr);
+	~Downloader();
+
+	QString fileName() const;
+	void setChecksum(const QByteArray &sha256);
+	void setCompressed(const QByteArray &sha256);
+	// Mirror RTT and failures are kept in the settings for the next run unless disabled
+	void setPersistentStats(bool persistent);
+	void setRateLimit(qint64 bytesPerSecond);
+	void start(const QString &filePath);
+
+Q_SIGNALS:
+	void downloadProgress(qint64 recvd, qint64 total);
+	void finished(const QString &error);
+
+private:
+	struct Mirror
+	{
+		QUrl url;
+		qint64 rtt = -1;
+		qint64 size = -1;
+		qint64 score = std::numeric_limits<qint64>::max();
+		bool ranges = false;
+	};
+	struct Stats
+	{
+		qint64 rtt = -1;
+		int failures = 0;
+	};
+
+	void copy(const QString &filePath);
+	void download();
+	void fail(const QString &error);
+	void finish(const QString &error);
+	void probe();
+	bool read(QNetworkReply *reply, bool throttle = true);
+	void reset();
+	bool verify() const;
+	bool write(QByteArrayView data);
+	Stats loadStats(const QString &host) const;
+	qint64 score(const Mirror &mirror) const;
+	void updateStats(const QUrl &url, qint64 rtt);
+
+	QNetworkAccessManager *manager;
+	QNetworkRequest request;
+	QList<Mirror> mirrors, uncompressed;
+	QHash<QString,Stats> memoryStats;
+	QFile file;
+	QString failure, rejected;
+	QByteArray checksum, uncompressedChecksum, buffer, chunk;
+	QCryptographicHash hash {QCryptographicHash::Sha256};
+	z_stream zs {};
+	int zstatus = Z_OK;
+	bool compressed = false, accepted = false, throttling = false, persistentStats = true;
+	qsizetype current = 0;
+	int attempts = 0, probing = 0;
+	qint64 size = -1, received = 0, inflateTime = 0;
+	qint64 rateLimit = 0, tokens = 0;
+	QElapsedTimer rateTimer;
+};
@@ -0,0 +1,54 @@
+/*
+ * id-updater
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "RepositoryExport.h"
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QNetworkAccessManager>
+#include <QNetworkProxyFactory>
+#include <QNetworkRequest>
+
+using namespace Qt::StringLiterals;
+
+/**
+ * id-updater-export <directory> [config url]
+ */
+int main(int argc, char *argv[])
+{
+	QCoreApplication app(argc, argv);
+	app.setApplicationName(u"id-updater-export"_s);
+	app.setApplicationVersion(u"" VERSION ""_s);
+	app.setOrganizationDomain(u"ria.ee"_s);
+	app.setOrganizationName(u"RIA"_s);
+	QNetworkProxyFactory::setUseSystemConfiguration(true);
+
+	QStringList args = app.arguments();
+	if(args.size() < 2)
+	{
+		qWarning().noquote() << "Usage:" << args.value(0) << "<directory> [config url]";
+		return 1;
+	}
+
+	QNetworkAccessManager manager;
+	QNetworkRequest request;
+	request.setRawHeader("User-Agent", "%1/%2 (export)"_L1
+		.arg(app.applicationName(), app.applicationVersion()).toUtf8());
+	return RepositoryExport::run(&manager, request, args.at(1), args.value(2, u"" CONFIG_URL ""_s)) ? 0 : 1;
+}
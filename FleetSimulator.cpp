@@ -0,0 +1,519 @@
+/*
+ * id-updater
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "Downloader.h"
+#include "LocalSource.h"
+#include "UpdaterConfig.h"
+#include "UserAgent.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QMutex>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QRandomGenerator>
+#include <QSettings>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <QThread>
+#include <QTimer>
+#include <QVersionNumber>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <memory>
+#include <numbers>
+#include <numeric>
+
+using namespace Qt::StringLiterals;
+
+constexpr qint64 DAY = 24 * 60 * 60;
+constexpr qsizetype SEND_CHUNK = 64 * 1024;
+constexpr int CONNECTIONS_PER_HOST = 6; // QNetworkAccessManager HTTP/1.1 limit
+
+template<typename T>
+static T percentile(QList<T> values, int p)
+{
+	if(values.isEmpty())
+		return {};
+	std::sort(values.begin(), values.end());
+	return values.at(std::min(values.size() - 1, values.size() * p / 100));
+}
+
+/**
+ * Serves files of an exported repository (id-updater-export) from memory with
+ * keep-alive and single byte range support, counting requests and sent bytes.
+ * A share of package responses is cut off halfway like an interrupted transfer.
+ */
+class StandInServer: public QTcpServer
+{
+public:
+	explicit StandInServer(const QString &root, int threadCount, double drop)
+		: drop(drop)
+	{
+		for(const QFileInfo &info: QDir(root).entryInfoList(QDir::Files))
+		{
+			if(QFile file(info.filePath()); file.open(QFile::ReadOnly))
+				files.insert(info.fileName(), file.readAll());
+		}
+		for(int i = 0; i < threadCount; ++i)
+		{
+			auto *thread = new QThread(this);
+			auto *context = new QObject;
+			context->moveToThread(thread);
+			connect(thread, &QThread::finished, context, &QObject::deleteLater);
+			thread->start();
+			contexts.append(context);
+		}
+	}
+	~StandInServer() final
+	{
+		for(QObject *context: std::as_const(contexts))
+		{
+			context->thread()->quit();
+			context->thread()->wait();
+		}
+	}
+
+	qsizetype fileCount() const { return files.size(); }
+
+	std::atomic<qint64> requests {0}, bytes {0}, heads {0}, ranges {0}, dropped {0};
+
+protected:
+	void incomingConnection(qintptr handle) final
+	{
+		QObject *context = contexts.at(next++ % contexts.size());
+		QMetaObject::invokeMethod(context, [this, context, handle] { accept(context, handle); });
+	}
+
+private:
+	struct Connection
+	{
+		QTcpSocket *socket;
+		QByteArray request;
+		QByteArrayView body;
+		bool close = false;
+	};
+
+	void accept(QObject *context, qintptr handle)
+	{
+		auto *socket = new QTcpSocket(context);
+		if(!socket->setSocketDescriptor(handle))
+			return socket->deleteLater();
+		auto c = std::make_shared<Connection>(socket);
+		connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+		connect(socket, &QTcpSocket::bytesWritten, socket, [this, c](qint64 written) {
+			bytes += written;
+			send(*c);
+		});
+		connect(socket, &QTcpSocket::readyRead, socket, [this, c] {
+			c->request += c->socket->readAll();
+			// One outstanding response per connection, clients do not pipeline
+			qsizetype end = 0;
+			while(c->body.isEmpty() && (end = c->request.indexOf("\r\n\r\n")) >= 0)
+			{
+				QByteArray header = c->request.left(end);
+				c->request.remove(0, end + 4);
+				respond(*c, header);
+			}
+		});
+	}
+
+	void respond(Connection &c, const QByteArray &header)
+	{
+		++requests;
+		const QList<QByteArray> lines = header.split('\n');
+		const QList<QByteArray> line = lines.value(0).trimmed().split(' ');
+		QByteArray path = line.value(1);
+		path = path.left(path.indexOf('?')).mid(path.lastIndexOf('/') + 1);
+		auto file = files.constFind(QString::fromUtf8(path));
+		if(file == files.cend())
+			return void(c.socket->write("HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n"));
+
+		qint64 size = file->size(), from = 0, to = size - 1;
+		bool partial = false;
+		for(const QByteArray &l: lines)
+		{
+			if(!l.toLower().startsWith("range: bytes="))
+				continue;
+			QList<QByteArray> range = l.trimmed().mid(13).split('-');
+			from = range.value(0).toLongLong();
+			to = range.value(1).isEmpty() ? size - 1 : std::min(range.value(1).toLongLong(), size - 1);
+			partial = true;
+		}
+		if(line.value(0) == "HEAD")
+			++heads;
+		else if(partial)
+			++ranges;
+		if(partial && (from > to || from >= size))
+			return void(c.socket->write("HTTP/1.1 416 Range Not Satisfiable\r\nContent-Length: 0\r\n\r\n"));
+
+		QByteArray response = partial ? "HTTP/1.1 206 Partial Content\r\n" : "HTTP/1.1 200 OK\r\n";
+		if(partial)
+			response += "Content-Range: bytes %1-%2/%3\r\n"_L1.arg(from).arg(to).arg(size).toLatin1();
+		response += "Content-Length: " + QByteArray::number(to - from + 1) + "\r\nAccept-Ranges: bytes\r\n\r\n";
+		c.socket->write(response);
+		if(line.value(0) == "GET")
+		{
+			c.body = QByteArrayView(*file).sliced(from, to - from + 1);
+			if(!partial && (path.endsWith(".msi") || path.endsWith(".gz")) && QRandomGenerator::global()->generateDouble() < drop)
+			{
+				++dropped;
+				c.body = c.body.first(c.body.size() / 2);
+				c.close = true;
+			}
+			send(c);
+		}
+	}
+
+	static void send(Connection &c)
+	{
+		// Keep socket buffer small, file content is shared between all connections
+		while(!c.body.isEmpty() && c.socket->bytesToWrite() < 4 * SEND_CHUNK)
+		{
+			QByteArrayView chunk = c.body.first(std::min(c.body.size(), SEND_CHUNK));
+			c.socket->write(chunk.data(), chunk.size());
+			c.body = c.body.sliced(chunk.size());
+		}
+		if(c.body.isEmpty() && c.close)
+			return c.socket->disconnectFromHost();
+		if(c.body.isEmpty() && !c.request.isEmpty())
+			QMetaObject::invokeMethod(c.socket, &QTcpSocket::readyRead, Qt::QueuedConnection);
+	}
+
+	QHash<QString,QByteArray> files;
+	QList<QObject*> contexts;
+	double drop;
+	int next = 0;
+};
+
+/**
+ * Simulated clients of one thread. Each client runs the same sequence as a scheduled
+ * -task run of the updater: config.ecc and config.json fetch, signature check and
+ * version decision, message fetch and package download with Downloader. Package mirrors
+ * of the configuration are served by the stand-in server under distinct URLs, so clients
+ * probe each of them, fail over between them and resume with range requests as in the field.
+ */
+class Fleet: public QObject
+{
+public:
+	struct Client
+	{
+		qint64 fireAt; // ms after simulation start
+		QByteArray userAgent;
+		bool outdated;
+	};
+
+	Fleet(const QUrl &base, const QString &target, int connections, std::atomic<int> &remaining)
+		: base(base)
+		, target(target)
+		, remaining(remaining)
+		, connections(connections)
+	{}
+
+	// Runs in the fleet thread, network managers and timer are created there
+	void start(QList<Client> list, const QElapsedTimer &epoch)
+	{
+		for(int i = 0; i < std::max(1, connections / CONNECTIONS_PER_HOST); ++i)
+			managers.append(new QNetworkAccessManager(this));
+		clients = std::move(list);
+		std::sort(clients.begin(), clients.end(), [](const Client &l, const Client &r) { return l.fireAt < r.fireAt; });
+		clock = epoch;
+		timer = new QTimer(this);
+		timer->setSingleShot(true);
+		timer->setTimerType(Qt::PreciseTimer);
+		connect(timer, &QTimer::timeout, this, &Fleet::fire);
+		fire();
+	}
+
+	QMutex mutex;
+	QList<qint64> latencies;
+	int failures = 0, downloads = 0;
+
+private:
+	void fire()
+	{
+		for(; next < clients.size() && clients.at(next).fireAt <= clock.elapsed(); ++next)
+			run(clients.at(next), next);
+		if(next < clients.size())
+			timer->start(std::chrono::milliseconds(clients.at(next).fireAt - clock.elapsed()));
+	}
+
+	void get(qsizetype i, QNetworkRequest request, const QString &path, std::function<void(QNetworkReply*)> &&done)
+	{
+		request.setUrl(base.resolved(QUrl(path)));
+		QNetworkReply *reply = managers.at(i % managers.size())->get(request);
+		connect(reply, &QNetworkReply::finished, this, [reply, done = std::move(done)] {
+			reply->deleteLater();
+			done(reply);
+		});
+	}
+
+	void run(const Client &client, qsizetype i)
+	{
+		QElapsedTimer decision;
+		decision.start();
+		QNetworkRequest request;
+		request.setRawHeader("User-Agent", client.userAgent);
+		get(i, request, u"config.ecc"_s, [=, this](QNetworkReply *ecc) {
+			if(ecc->error() != QNetworkReply::NoError)
+				return finish(ecc->errorString());
+			QByteArray signature = QByteArray::fromBase64(ecc->readAll());
+			get(i, request, u"config.json"_s, [=, this](QNetworkReply *json) {
+				QByteArray data = json->readAll();
+				UpdaterConfig config;
+				if(json->error() != QNetworkReply::NoError || !LocalSource::verify(data, signature) ||
+					!config.update(QJsonDocument::fromJson(data).object()))
+					return finish(u"Invalid configuration"_s);
+				QVersionNumber installed = client.outdated ? QVersionNumber(0) : QVersionNumber::fromString(config.package.latest);
+				bool update = installed < QVersionNumber::fromString(config.package.latest);
+				{
+					QMutexLocker lock(&mutex);
+					latencies.append(decision.elapsed());
+				}
+				if(!config.messageUrl.isEmpty())
+					get(i, request, config.messageUrl.fileName(), [](QNetworkReply *) {});
+				if(!update)
+					return finish({});
+				download(i, request, config.package);
+			});
+		});
+	}
+
+	void download(qsizetype i, const QNetworkRequest &request, UpdaterConfig::Package package)
+	{
+		auto rewrite = [this](QList<QUrl> &urls) {
+			for(qsizetype m = 0; m < urls.size(); ++m)
+			{
+				QUrl url = base.resolved(QUrl(urls.at(m).fileName()));
+				url.setQuery(u"mirror=%1"_s.arg(m));
+				urls[m] = url;
+			}
+		};
+		rewrite(package.mirrors);
+		rewrite(package.compressed);
+		QString filePath = target.filePath(u"%1-%2"_s.arg(quint64(quintptr(this)), 0, 16).arg(i));
+		auto *download = new Downloader(managers.at(i % managers.size()), request, package, this);
+		// Each client has its own mirror history, all clients share the simulator settings
+		download->setPersistentStats(false);
+		connect(download, &Downloader::finished, this, [this, download, filePath](const QString &error) {
+			download->deleteLater();
+			QFile::remove(filePath);
+			if(error.isEmpty())
+			{
+				QMutexLocker lock(&mutex);
+				++downloads;
+			}
+			finish(error);
+		});
+		download->start(filePath);
+	}
+
+	void finish(const QString &error)
+	{
+		if(!error.isEmpty())
+		{
+			QMutexLocker lock(&mutex);
+			++failures;
+		}
+		if(--remaining == 0)
+			QMetaObject::invokeMethod(qApp, &QCoreApplication::quit, Qt::QueuedConnection);
+	}
+
+	QUrl base;
+	QDir target;
+	std::atomic<int> &remaining;
+	int connections;
+	QList<QNetworkAccessManager*> managers;
+	QList<Client> clients;
+	QElapsedTimer clock;
+	QTimer *timer {};
+	qsizetype next = 0;
+};
+
+/**
+ * Trigger time of a client in seconds of the simulated day. Scheduled task starts at the
+ * time of day it was configured, usually during working hours. Computers that are off at
+ * that time run the missed task on next boot (StartWhenAvailable) in the morning.
+ */
+static qint64 triggerTime(QRandomGenerator &random, double offline)
+{
+	if(random.generateDouble() >= offline)
+		return 8 * 3600 + qint64(random.bounded(9 * 3600));
+	// Box-Muller, boot time around 08:30 +- 30min
+	double u1 = std::max(random.generateDouble(), 1e-9), u2 = random.generateDouble();
+	double boot = 8.5 * 3600 + 1800 * std::sqrt(-2 * std::log(u1)) * std::cos(2 * std::numbers::pi * u2);
+	return std::clamp(qint64(boot), qint64(0), DAY - 1);
+}
+
+int main(int argc, char *argv[])
+{
+	QCoreApplication app(argc, argv);
+	// Same product name as the updater for the User-Agent
+	app.setApplicationName(u"id-updater"_s);
+	app.setApplicationVersion(u"" VERSION ""_s);
+
+	QCommandLineParser parser;
+	parser.setApplicationDescription(u"Simulates scheduled update checks of a client fleet"_s);
+	parser.addHelpOption();
+	parser.addPositionalArgument(u"repository"_s, u"Directory exported with id-updater-export served by the stand-in server"_s);
+	QCommandLineOption url(u"url"_s, u"Use existing server instead of the stand-in server"_s, u"url"_s);
+	QCommandLineOption clients(u"clients"_s, u"Number of clients"_s, u"count"_s, u"20000"_s);
+	QCommandLineOption schedule(u"schedule"_s, u"Task schedule: daily, weekly or monthly"_s, u"schedule"_s, u"daily"_s);
+	QCommandLineOption speedup(u"speedup"_s, u"Simulated seconds per real second"_s, u"factor"_s, u"720"_s);
+	QCommandLineOption offline(u"offline"_s, u"Share of clients that run missed task on boot"_s, u"share"_s, u"0.3"_s);
+	QCommandLineOption outdated(u"outdated"_s, u"Share of clients that download update"_s, u"share"_s, u"0.05"_s);
+	QCommandLineOption drop(u"drop"_s, u"Share of package responses cut off halfway by the stand-in server"_s, u"share"_s, u"0.1"_s);
+	QCommandLineOption threads(u"threads"_s, u"Client and server threads"_s, u"count"_s, QString::number(QThread::idealThreadCount()));
+	QCommandLineOption connections(u"connections"_s, u"Concurrent connections per client thread"_s, u"count"_s, u"256"_s);
+	parser.addOptions({url, clients, schedule, speedup, offline, outdated, drop, threads, connections});
+	parser.process(app);
+
+	static const QHash<QString,int> interval {{u"daily"_s, 1}, {u"weekly"_s, 7}, {u"monthly"_s, 30}};
+	if(!interval.contains(parser.value(schedule)) || (parser.positionalArguments().isEmpty() && !parser.isSet(url)))
+		parser.showHelp(1);
+	int threadCount = std::max(1, parser.value(threads).toInt());
+	double factor = std::max(1.0, parser.value(speedup).toDouble());
+
+	// Package downloads stay out of the updater directories
+	QTemporaryDir target;
+	if(!target.isValid())
+	{
+		qWarning() << "Failed to create download directory" << target.errorString();
+		return 1;
+	}
+	QSettings::setDefaultFormat(QSettings::IniFormat);
+	QSettings::setPath(QSettings::IniFormat, QSettings::UserScope, target.path());
+
+	std::unique_ptr<StandInServer> server;
+	QUrl base(parser.value(url));
+	if(!parser.isSet(url))
+	{
+		server = std::make_unique<StandInServer>(parser.positionalArguments().first(), threadCount, parser.value(drop).toDouble());
+		if(server->fileCount() == 0 || !server->listen(QHostAddress::LocalHost))
+		{
+			qWarning() << "Failed to start stand-in server";
+			return 1;
+		}
+		base = QUrl(u"http://127.0.0.1:%1/"_s.arg(server->serverPort()));
+		server->setMaxPendingConnections(1024);
+	}
+	qDebug() << "Serving from" << base.toString();
+
+	// Only clients whose trigger matches the simulated day run, the rest of the fleet stays idle
+	QRandomGenerator random(QRandomGenerator::global()->generate());
+	static const QStringList os {u"Windows 11 (64 bit)"_s, u"Windows 10 (64 bit)"_s, u"Windows 11 (ARM64)"_s};
+	static const QStringList devices {u"ACS ACR39U (4.2.8.0)"_s, u"Omnikey 3x21 (3.1.0.2)"_s, u"Microsoft Usbccid Smartcard Reader (WUDF) (10.0.22621.1)"_s};
+	QList<QList<Fleet::Client>> lists(threadCount);
+	for(int i = 0, count = parser.value(clients).toInt(); i < count; ++i)
+	{
+		if(random.bounded(interval.value(parser.value(schedule))) != 0)
+			continue;
+		qint64 fireAt = qint64(triggerTime(random, parser.value(offline).toDouble()) * 1000 / factor);
+		QString ua = userAgent(os.at(random.bounded(int(os.size()))), u"et"_s,
+			{devices.at(random.bounded(int(devices.size())))});
+		lists[i % threadCount].append({fireAt, ua.toUtf8(), random.generateDouble() < parser.value(outdated).toDouble()});
+	}
+	std::atomic<int> remaining = 0;
+	for(const auto &list: std::as_const(lists))
+		remaining += int(list.size());
+	if(remaining == 0)
+	{
+		qWarning() << "No clients scheduled";
+		return 1;
+	}
+	qDebug() << "Simulating" << remaining.load() << "of" << parser.value(clients) << "clients with"
+		<< parser.value(schedule) << "schedule," << DAY / factor << "s real time";
+
+	QElapsedTimer epoch;
+	epoch.start();
+	QList<Fleet*> fleets;
+	for(int i = 0; i < threadCount; ++i)
+	{
+		auto *thread = new QThread(&app);
+		auto *fleet = new Fleet(base, target.path(), parser.value(connections).toInt(), remaining);
+		fleet->moveToThread(thread);
+		QObject::connect(thread, &QThread::finished, fleet, &QObject::deleteLater);
+		thread->start();
+		QMetaObject::invokeMethod(fleet, [fleet, list = lists.at(i), epoch] { fleet->start(list, epoch); });
+		fleets.append(fleet);
+	}
+
+	QList<qint64> rates, bandwidth;
+	QTimer sample;
+	QObject::connect(&sample, &QTimer::timeout, &app, [&] {
+		if(!server)
+			return;
+		rates.append(server->requests.exchange(0));
+		bandwidth.append(server->bytes.exchange(0));
+	});
+	sample.start(std::chrono::seconds(1));
+	app.exec();
+	qint64 elapsed = epoch.elapsed();
+
+	QList<qint64> latencies;
+	int failures = 0, downloads = 0;
+	for(Fleet *fleet: std::as_const(fleets))
+	{
+		QMutexLocker lock(&fleet->mutex);
+		latencies += fleet->latencies;
+		failures += fleet->failures;
+		downloads += fleet->downloads;
+	}
+	for(Fleet *fleet: std::as_const(fleets))
+	{
+		fleet->thread()->quit();
+		fleet->thread()->wait();
+	}
+
+	QTextStream out(stdout);
+	out << "Clients: " << latencies.size() << " decided, " << downloads << " downloaded, " << failures << " failed in "
+		<< elapsed / 1000.0 << " s (" << elapsed * factor / 3600000.0 << " simulated hours)\n";
+	out << "Decision latency ms: p50 " << percentile(latencies, 50) << " p90 " << percentile(latencies, 90)
+		<< " p99 " << percentile(latencies, 99) << " max " << percentile(latencies, 100) << '\n';
+	if(server)
+	{
+		// Samples are taken each real second, which covers factor seconds of the simulated day
+		qint64 total = std::accumulate(rates.cbegin(), rates.cend(), qint64(0));
+		double mean = double(total) / std::max<qsizetype>(1, rates.size());
+		out << "Server requests/s (simulated time): mean " << mean / factor << " p90 " << percentile(rates, 90) / factor
+			<< " max " << percentile(rates, 100) / factor << '\n';
+		out << "Server MiB/s (simulated time): p50 " << percentile(bandwidth, 50) / factor / 1048576.0
+			<< " p90 " << percentile(bandwidth, 90) / factor / 1048576.0
+			<< " p99 " << percentile(bandwidth, 99) / factor / 1048576.0
+			<< " max " << percentile(bandwidth, 100) / factor / 1048576.0 << '\n';
+		out << "Server requests/s (real time): mean " << mean << " p90 " << percentile(rates, 90)
+			<< " max " << percentile(rates, 100) << '\n';
+		out << "Server MiB/s (real time): p50 " << percentile(bandwidth, 50) / 1048576.0 << " p90 " << percentile(bandwidth, 90) / 1048576.0
+			<< " p99 " << percentile(bandwidth, 99) / 1048576.0 << " max " << percentile(bandwidth, 100) / 1048576.0 << '\n';
+		out << "Server package requests: " << server->heads << " mirror probes, " << server->ranges << " resumed, "
+			<< server->dropped << " cut off\n";
+		out << "Real seconds scale to " << factor << " seconds of the simulated day\n";
+	}
+	return failures == 0 ? 0 : 2;
+}
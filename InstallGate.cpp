@@ -0,0 +1,142 @@
+/*
+ * id-updater
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "InstallGate.h"
+
+#include <QDebug>
+#include <QList>
+#include <QSettings>
+
+#ifdef Q_OS_WIN
+#include <qt_windows.h>
+#include <winscard.h>
+#endif
+
+#include <algorithm>
+#include <array>
+
+using namespace Qt::StringLiterals;
+using namespace std::chrono;
+
+InstallGate::InstallGate(Probes probes, Policy policy, QObject *parent)
+	: QObject(parent)
+	, probes(std::move(probes))
+	, policy(policy)
+{
+	connect(&timer, &QTimer::timeout, this, &InstallGate::check);
+}
+
+InstallGate::Probes InstallGate::Probes::system()
+{
+#ifdef Q_OS_WIN
+	return {
+		[] {
+			LASTINPUTINFO info { sizeof(info) };
+			if(!GetLastInputInfo(&info))
+				return milliseconds::zero();
+			return milliseconds(GetTickCount() - info.dwTime);
+		},
+		[previous = std::array<quint64,3>{}]() mutable {
+			FILETIME idle {}, kernel {}, user {};
+			if(!GetSystemTimes(&idle, &kernel, &user))
+				return 0;
+			auto value = [](FILETIME t) { return quint64(t.dwHighDateTime) << 32 | t.dwLowDateTime; };
+			std::array<quint64,3> current {value(idle), value(kernel), value(user)};
+			// Kernel time includes idle time
+			quint64 total = (current[1] - previous[1]) + (current[2] - previous[2]);
+			quint64 busy = total - (current[0] - previous[0]);
+			previous = current;
+			return total == 0 ? 0 : int(busy * 100 / total);
+		},
+		[] {
+			SCARDCONTEXT context {};
+			if(SCardEstablishContext(SCARD_SCOPE_USER, nullptr, nullptr, &context) != SCARD_S_SUCCESS)
+				return false;
+			bool inUse = false;
+			LPWSTR readers = nullptr;
+			DWORD size = SCARD_AUTOALLOCATE;
+			if(SCardListReadersW(context, nullptr, LPWSTR(&readers), &size) == SCARD_S_SUCCESS)
+			{
+				QList<SCARD_READERSTATEW> states;
+				for(LPCWSTR reader = readers; *reader; reader += wcslen(reader) + 1)
+					states.append(SCARD_READERSTATEW{reader, nullptr, SCARD_STATE_UNAWARE});
+				if(SCardGetStatusChangeW(context, 0, states.data(), DWORD(states.size())) == SCARD_S_SUCCESS)
+				{
+					inUse = std::any_of(states.cbegin(), states.cend(), [](const SCARD_READERSTATEW &state) {
+						return state.dwEventState & (SCARD_STATE_INUSE|SCARD_STATE_EXCLUSIVE);
+					});
+				}
+				SCardFreeMemory(context, readers);
+			}
+			SCardReleaseContext(context);
+			return inUse;
+		},
+	};
+#else
+	// Idle time, load and card sessions are only tracked on Windows, never hold back the install
+	return {
+		[] { return milliseconds::max(); },
+		[] { return 0; },
+		[] { return false; },
+	};
+#endif
+}
+
+InstallGate::Policy InstallGate::Policy::fromSettings()
+{
+	QSettings s;
+	Policy policy;
+	policy.idle = minutes(s.value(u"InstallIdle"_s, 5).toInt());
+	policy.deadline = minutes(s.value(u"InstallDeadline"_s, 240).toInt());
+	policy.load = s.value(u"InstallLoad"_s, policy.load).toInt();
+	return policy;
+}
+
+bool InstallGate::isOpen() const
+{
+	return open;
+}
+
+void InstallGate::start()
+{
+	if(open || timer.isActive())
+		return;
+	waited.start();
+	// First sample covers the time since boot, prime it and take the first decision only
+	// after one interval, so the load covers a full interval of this session
+	probes.load();
+	timer.start(policy.interval);
+}
+
+void InstallGate::check()
+{
+	milliseconds idle = probes.idle();
+	int load = probes.load();
+	bool cardInUse = probes.cardInUse();
+	bool expired = waited.durationElapsed() >= policy.deadline;
+	qDebug() << "Install gate: idle" << idle.count() / 1000 << "s load" << load << "% card in use" << cardInUse
+		<< "waited" << waited.elapsed() / 1000 << "s";
+	if(!expired && (idle < policy.idle || load > policy.load || cardInUse))
+		return;
+	if(expired)
+		qDebug() << "Install gate deadline reached, installing";
+	timer.stop();
+	open = true;
+	emit opened();
+}
@@ -0,0 +1,67 @@
+/*
+ * id-updater
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#pragma once
+
+#include <QElapsedTimer>
+#include <QObject>
+#include <QTimer>
+
+#include <chrono>
+#include <functional>
+
+class InstallGate: public QObject
+{
+	Q_OBJECT
+public:
+	struct Probes
+	{
+		std::function<std::chrono::milliseconds ()> idle; // since last user input
+		std::function<int ()> load; // CPU load percent since previous call
+		std::function<bool ()> cardInUse; // card session open by other application
+
+		static Probes system();
+	};
+	struct Policy
+	{
+		std::chrono::milliseconds idle {std::chrono::minutes(5)};
+		std::chrono::milliseconds interval {std::chrono::seconds(30)};
+		std::chrono::milliseconds deadline {std::chrono::hours(4)};
+		int load = 50;
+
+		static Policy fromSettings();
+	};
+
+	explicit InstallGate(Probes probes, Policy policy, QObject *parent = nullptr);
+
+	bool isOpen() const;
+	void start();
+
+Q_SIGNALS:
+	void opened();
+
+private:
+	void check();
+
+	Probes probes;
+	Policy policy;
+	QTimer timer;
+	QElapsedTimer waited;
+	bool open = false;
+};
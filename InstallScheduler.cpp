@@ -0,0 +1,128 @@
+/*
+ * id-updater
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "InstallScheduler.h"
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QPointer>
+
+#include <algorithm>
+
+InstallScheduler::InstallScheduler(Stage download, Stage verify, Stage install, QObject *parent)
+	: QObject(parent)
+	, queues {{
+		{"download", std::move(download)},
+		{"verify", std::move(verify)},
+		{"install", std::move(install)},
+	}}
+{}
+
+bool InstallScheduler::start(const QList<UpdaterConfig::Package> &list)
+{
+	packages = sort(list);
+	if(packages.size() != list.size())
+		return false;
+	if(packages.isEmpty())
+	{
+		finish({});
+		return true;
+	}
+	for(qsizetype i = 0; i < packages.size(); ++i)
+		enqueue(Download, i);
+	return true;
+}
+
+QList<UpdaterConfig::Package> InstallScheduler::sort(const QList<UpdaterConfig::Package> &packages)
+{
+	// Stable topological order, dependencies that are not in the list are already up to date
+	QList<UpdaterConfig::Package> result;
+	QList<bool> added(packages.size(), false);
+	auto isPending = [&](const QString &name) {
+		for(qsizetype i = 0; i < packages.size(); ++i)
+		{
+			if(!added[i] && packages[i].name == name)
+				return true;
+		}
+		return false;
+	};
+	for(bool progress = true; progress && result.size() < packages.size();)
+	{
+		progress = false;
+		for(qsizetype i = 0; i < packages.size(); ++i)
+		{
+			if(added[i] || std::any_of(packages[i].depends.cbegin(), packages[i].depends.cend(), isPending))
+				continue;
+			result.append(packages[i]);
+			added[i] = progress = true;
+			break;
+		}
+	}
+	return result;
+}
+
+void InstallScheduler::enqueue(StageType type, qsizetype index)
+{
+	Queue &queue = queues[type];
+	queue.pending.append(index);
+	queue.maxDepth = std::max(queue.maxDepth, queue.pending.size());
+	qDebug() << "Queue" << queue.name << "depth" << queue.pending.size();
+	next(type);
+}
+
+void InstallScheduler::finish(const QString &error)
+{
+	done = true;
+	for(const Queue &queue: queues)
+		qDebug() << "Stage" << queue.name << "took" << queue.elapsed << "ms, max queue depth" << queue.maxDepth;
+	emit finished(error);
+}
+
+void InstallScheduler::next(StageType type)
+{
+	Queue &queue = queues[type];
+	if(done || queue.busy || queue.pending.isEmpty())
+		return;
+	queue.busy = true;
+	qsizetype index = queue.pending.takeFirst();
+	QElapsedTimer timer;
+	timer.start();
+	queue.run(packages.at(index), [self = QPointer(this), type, index, timer](const QString &error) {
+		// Always continue from the event loop, stages may call back synchronously or from other threads.
+		// The scheduler is checked only on the main thread, it may be deleted meanwhile.
+		QMetaObject::invokeMethod(QCoreApplication::instance(), [self, type, index, timer, error] {
+			if(!self)
+				return;
+			Queue &queue = self->queues[type];
+			queue.busy = false;
+			queue.elapsed += timer.elapsed();
+			qDebug() << "Stage" << queue.name << self->packages.at(index).name << "took" << timer.elapsed() << "ms" << error;
+			if(self->done)
+				return;
+			if(!error.isEmpty())
+				return self->finish(error);
+			if(type != Install)
+				self->enqueue(StageType(type + 1), index);
+			else if(++self->installed == self->packages.size())
+				return self->finish({});
+			self->next(type);
+		}, Qt::QueuedConnection);
+	});
+}
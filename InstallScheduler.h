@@ -0,0 +1,69 @@
+/*
+ * id-updater
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#pragma once
+
+#include "UpdaterConfig.h"
+
+#include <QObject>
+
+#include <array>
+#include <functional>
+
+class InstallScheduler: public QObject
+{
+	Q_OBJECT
+public:
+	using Done = std::function<void (const QString &error)>;
+	using Stage = std::function<void (const UpdaterConfig::Package &package, const Done &done)>;
+
+	explicit InstallScheduler(Stage download, Stage verify, Stage install, QObject *parent = nullptr);
+
+	bool start(const QList<UpdaterConfig::Package> &packages);
+	static QList<UpdaterConfig::Package> sort(const QList<UpdaterConfig::Package> &packages);
+
+Q_SIGNALS:
+	void finished(const QString &error);
+
+private:
+	enum StageType: quint8 {
+		Download,
+		Verify,
+		Install,
+		StageCount
+	};
+	struct Queue
+	{
+		const char *name;
+		Stage run;
+		QList<qsizetype> pending;
+		bool busy = false;
+		qsizetype maxDepth = 0;
+		qint64 elapsed = 0;
+	};
+
+	void enqueue(StageType type, qsizetype index);
+	void finish(const QString &error);
+	void next(StageType type);
+
+	QList<UpdaterConfig::Package> packages;
+	std::array<Queue, StageCount> queues;
+	qsizetype installed = 0;
+	bool done = false;
+};
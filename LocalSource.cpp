@@ -0,0 +1,176 @@
+/*
+ * id-updater
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "LocalSource.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDebug>
+#include <QFile>
+#include <QJsonDocument>
+#include <QSettings>
+#include <QTimeZone>
+#include <QUrl>
+
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+
+#include <algorithm>
+#include <memory>
+
+using namespace Qt::StringLiterals;
+
+LocalSource::LocalSource(const QString &source)
+{
+	QUrl url(source);
+	if(url.isLocalFile())
+		path = url.toLocalFile();
+	else if(url.scheme() == "smb"_L1)
+		path = "//%1%2"_L1.arg(url.host(), url.path());
+	else
+		path = source;
+}
+
+QByteArray LocalSource::checksum(const QString &filePath)
+{
+	QFile file(filePath);
+	if(!file.open(QFile::ReadOnly))
+		return {};
+	if(file.size() == 0)
+		return QCryptographicHash::hash({}, QCryptographicHash::Sha256);
+	const uchar *data = file.map(0, file.size());
+	if(!data)
+		return {};
+	return QCryptographicHash::hash(QByteArrayView(data, file.size()), QCryptographicHash::Sha256);
+}
+
+QString LocalSource::filePath(const QString &fileName) const
+{
+	return path + '/' + fileName;
+}
+
+static QDateTime metaDate(const QJsonObject &meta)
+{
+	QDateTime date = QDateTime::fromString(meta.value("DATE"_L1).toString(), u"yyyyMMddHHmmss'Z'"_s);
+	date.setTimeZone(QTimeZone::UTC);
+	return date;
+}
+
+QString LocalSource::read(QJsonObject &next) const
+{
+	QFile json(filePath(u"config.json"_s)), ecc(filePath(u"config.ecc"_s));
+	if(!json.open(QFile::ReadOnly) || !ecc.open(QFile::ReadOnly))
+		return tr("Failed to open update repository %1").arg(path);
+	const uchar *data = json.map(0, json.size());
+	if(!data)
+		return json.errorString();
+	if(!verify(QByteArrayView(data, json.size()), QByteArray::fromBase64(ecc.readAll())))
+		return tr("The configuration file located on the server cannot be validated.");
+
+	next = QJsonDocument::fromJson(QByteArray::fromRawData((const char*)data, json.size())).object();
+	QJsonObject meta = next.value("META-INF"_L1).toObject();
+	QDateTime date = metaDate(meta);
+	if(!date.isValid() || date > QDateTime::currentDateTimeUtc() || meta.value("SERIAL"_L1).toInt(-1) < 0)
+		return tr("The configuration file located on the server cannot be validated.");
+	return {};
+}
+
+void LocalSource::accept(QJsonObject &&next)
+{
+	obj = std::move(next);
+	index.clear();
+	if(QFile file(filePath(u"index.json"_s)); file.open(QFile::ReadOnly))
+	{
+		const QJsonObject files = QJsonDocument::fromJson(file.readAll()).object();
+		for(auto i = files.begin(); i != files.end(); ++i)
+			index.insert(i.key(), QByteArray::fromHex(i.value().toString().toLatin1()));
+	}
+	qDebug() << "Loaded update repository" << path << "with" << index.size() << "files";
+}
+
+QString LocalSource::check()
+{
+	QJsonObject next;
+	if(QString err = read(next); !err.isEmpty())
+		return err;
+	accept(std::move(next));
+	return {};
+}
+
+QString LocalSource::load(const QJsonObject &trusted)
+{
+	QJsonObject next;
+	if(QString err = read(next); !err.isEmpty())
+		return err;
+	QJsonObject meta = next.value("META-INF"_L1).toObject();
+	QDateTime date = metaDate(meta);
+	int serial = meta.value("SERIAL"_L1).toInt();
+
+	// Rollback protection as in Configuration: the repository may not be older than the built-in or
+	// cached configuration, nor older than a repository configuration accepted before
+	QSettings s;
+	QJsonObject trustedMeta = trusted.value("META-INF"_L1).toObject();
+	int minSerial = std::max(trustedMeta.value("SERIAL"_L1).toInt(-1), s.value(u"SourceSerial"_s, -1).toInt());
+	QDateTime minDate = std::max(metaDate(trustedMeta), s.value(u"SourceDate"_s).toDateTime());
+	if(serial < minSerial || (minDate.isValid() && date < minDate))
+	{
+		qWarning() << "Repository configuration" << serial << date << "is older than" << minSerial << minDate;
+		return tr("Your computer's configuration file is later than the server has.");
+	}
+	s.setValue(u"SourceSerial"_s, serial);
+	s.setValue(u"SourceDate"_s, date);
+	accept(std::move(next));
+	return {};
+}
+
+bool LocalSource::verify(QByteArrayView data, const QByteArray &signature)
+{
+	// Same trust anchor as the online configuration. The ECDSA digest follows the key size
+	// (P-256 SHA-256, P-384 SHA-384, P-521 SHA-512) as in prefPane/update.swift.
+	QFile pub(u":/config.ecpub"_s);
+	if(!pub.open(QFile::ReadOnly))
+		return false;
+	QByteArray key = pub.readAll();
+	std::unique_ptr<BIO, decltype(&BIO_free)> bio(BIO_new_mem_buf(key.constData(), int(key.size())), BIO_free);
+	std::unique_ptr<EVP_PKEY, decltype(&EVP_PKEY_free)> pkey(PEM_read_bio_PUBKEY(bio.get(), nullptr, nullptr, nullptr), EVP_PKEY_free);
+	std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> ctx(EVP_MD_CTX_new(), EVP_MD_CTX_free);
+	int bits = pkey ? EVP_PKEY_get_bits(pkey.get()) : 0;
+	const EVP_MD *md = bits <= 256 ? EVP_sha256() : bits <= 384 ? EVP_sha384() : EVP_sha512();
+	return pkey && ctx && EVP_DigestVerifyInit(ctx.get(), nullptr, md, nullptr, pkey.get()) == 1 &&
+		EVP_DigestVerify(ctx.get(), (const unsigned char*)signature.constData(), size_t(signature.size()),
+			(const unsigned char*)data.data(), size_t(data.size())) == 1;
+}
+
+QJsonObject LocalSource::object() const
+{
+	return obj;
+}
+
+void LocalSource::resolve(UpdaterConfig::Package &package) const
+{
+	if(QString name = package.compressed.value(0).fileName(); !name.isEmpty() && index.contains(name))
+		package.compressed = { QUrl::fromLocalFile(filePath(name)) };
+	else
+		package.compressed.clear();
+	if(QString name = package.fileName(); !name.isEmpty())
+	{
+		package.mirrors = { QUrl::fromLocalFile(filePath(name)) };
+		package.checksum = index.value(name);
+	}
+}
@@ -0,0 +1,51 @@
+/*
+ * id-updater
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#pragma once
+
+#include "UpdaterConfig.h"
+
+#include <QCoreApplication>
+#include <QHash>
+#include <QJsonObject>
+
+class LocalSource
+{
+	Q_DECLARE_TR_FUNCTIONS(LocalSource)
+public:
+	explicit LocalSource(const QString &path);
+
+	QString filePath(const QString &fileName) const;
+	QString load(const QJsonObject &trusted = {});
+	/** Verifies signature and date like load() without rollback protection, used by the export */
+	QString check();
+	QJsonObject object() const;
+	void resolve(UpdaterConfig::Package &package) const;
+
+	static QByteArray checksum(const QString &filePath);
+	static bool verify(QByteArrayView data, const QByteArray &signature);
+
+private:
+	QString read(QJsonObject &next) const;
+	void accept(QJsonObject &&next);
+
+	QString path;
+	QJsonObject obj;
+	QHash<QString,QByteArray> index;
+};
@@ -0,0 +1,168 @@
+/*
+ * id-updater
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "RepositoryExport.h"
+
+#include "Downloader.h"
+#include "LocalSource.h"
+#include "UpdaterConfig.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QEventLoop>
+#include <QFileInfo>
+#include <QHash>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+#include <QTemporaryDir>
+
+using namespace Qt::StringLiterals;
+
+bool RepositoryExport::run(QNetworkAccessManager *manager, const QNetworkRequest &request,
+	const QString &directory, const QString &configUrl)
+{
+	// Export is staged in a sibling directory and replaces the previous export only when it is
+	// complete, a failed run leaves the working repository in place
+	const QString target = QDir(directory).absolutePath();
+	if(!QDir().mkpath(QFileInfo(target).absolutePath()))
+	{
+		qWarning() << "Failed to create directory" << QFileInfo(target).absolutePath();
+		return false;
+	}
+	QTemporaryDir staging(target + ".XXXXXX"_L1);
+	if(!staging.isValid())
+	{
+		qWarning() << "Failed to create directory" << staging.errorString();
+		return false;
+	}
+	QDir dir(staging.path());
+
+	QJsonObject index;
+	// Files are stored flat by name, names are compared case-insensitively as on Windows shares
+	QHash<QString,QUrl> sources;
+	auto fetch = [&](const QList<QUrl> &urls, const QString &fileName, const QByteArray &checksum = {}) {
+		if(fileName.isEmpty())
+			return true;
+		if(auto i = sources.constFind(fileName.toLower()); i != sources.cend())
+		{
+			if(i.value() == urls.value(0))
+				return true;
+			qWarning() << "File name" << fileName << "is used by" << i.value() << "and" << urls.value(0);
+			return false;
+		}
+		sources.insert(fileName.toLower(), urls.value(0));
+		// Packages are stored as served, compressed variants are not inflated
+		Downloader download(manager, request, urls);
+		download.setChecksum(checksum);
+		QEventLoop loop;
+		QString err;
+		bool done = false;
+		QObject::connect(&download, &Downloader::finished, &loop, [&](const QString &error) {
+			err = error;
+			done = true;
+			loop.quit();
+		});
+		qDebug() << "Exporting" << fileName;
+		download.start(dir.filePath(fileName));
+		if(!done)
+			loop.exec();
+		if(!err.isEmpty())
+		{
+			qWarning() << "Failed to export" << fileName << err;
+			return false;
+		}
+		index.insert(fileName, QString::fromLatin1(LocalSource::checksum(dir.filePath(fileName)).toHex()));
+		return true;
+	};
+
+	QString eccUrl = configUrl;
+	eccUrl.replace(".json"_L1, ".ecc"_L1);
+	if(!fetch({QUrl(configUrl)}, u"config.json"_s) || !fetch({QUrl(eccUrl)}, u"config.ecc"_s))
+		return false;
+	index = {};
+	sources.clear();
+
+	// Rollback state belongs to the clients, a staging export with a later serial may not
+	// block exporting the production configuration afterwards
+	LocalSource source(dir.absolutePath());
+	if(QString err = source.check(); !err.isEmpty())
+	{
+		qWarning() << "Failed to verify configuration:" << err;
+		return false;
+	}
+	UpdaterConfig config;
+	if(!config.update(source.object()))
+	{
+		qWarning() << "Invalid configuration";
+		return false;
+	}
+
+	QList<UpdaterConfig::Package> packages = config.components;
+	packages.prepend(config.package);
+	for(const UpdaterConfig::Package &package: std::as_const(packages))
+	{
+		// Package may not replace the repository metadata
+		for(const QString &name: {package.fileName(), package.compressed.value(0).fileName()})
+		{
+			if(name.compare("config.json"_L1, Qt::CaseInsensitive) == 0 ||
+				name.compare("config.ecc"_L1, Qt::CaseInsensitive) == 0 ||
+				name.compare("index.json"_L1, Qt::CaseInsensitive) == 0)
+			{
+				qWarning() << "Package file name" << name << "is reserved";
+				return false;
+			}
+		}
+		if(!fetch(package.mirrors, package.fileName()))
+			return false;
+		if(!package.compressed.isEmpty() &&
+			!fetch(package.compressed, package.compressed.first().fileName(), package.compressedHash))
+			return false;
+	}
+
+	QSaveFile file(dir.filePath(u"index.json"_s));
+	if(!file.open(QFile::WriteOnly) ||
+		file.write(QJsonDocument(index).toJson()) < 0 ||
+		!file.commit())
+	{
+		qWarning() << "Failed to write index" << file.errorString();
+		return false;
+	}
+
+	const QString backup = target + ".old"_L1;
+	QDir(backup).removeRecursively();
+	if(QFileInfo::exists(target) && !QDir().rename(target, backup))
+	{
+		qWarning() << "Failed to replace" << target;
+		return false;
+	}
+	if(!QDir().rename(staging.path(), target))
+	{
+		qWarning() << "Failed to replace" << target;
+		QDir().rename(backup, target);
+		return false;
+	}
+	staging.setAutoRemove(false);
+	// Temporary directory is private to the user, repository is read by clients
+	QFile::setPermissions(target, QFile::ReadOwner | QFile::WriteOwner | QFile::ExeOwner |
+		QFile::ReadGroup | QFile::ExeGroup | QFile::ReadOther | QFile::ExeOther);
+	QDir(backup).removeRecursively();
+	qDebug() << "Exported" << index.size() << "packages to" << target;
+	return true;
+}
@@ -0,0 +1,36 @@
+/*
+ * id-updater
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#pragma once
+
+#include <QString>
+
+class QNetworkAccessManager;
+class QNetworkRequest;
+
+class RepositoryExport
+{
+public:
+	/**
+	 * Mirrors signed configuration and all referenced packages to a directory that
+	 * can be used by the updater with -source or the Source setting.
+	 */
+	static bool run(QNetworkAccessManager *manager, const QNetworkRequest &request,
+		const QString &directory, const QString &configUrl);
+};
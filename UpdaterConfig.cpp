@@ -0,0 +1,130 @@
+/*
+ * id-updater
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "UpdaterConfig.h"
+
+#include <QJsonArray>
+#include <QJsonObject>
+
+using namespace Qt::StringLiterals;
+
+static bool isType(const QJsonObject &obj, const QString &key, QJsonValue::Type type)
+{
+	QJsonValue value = obj.value(key);
+	return value.isUndefined() || value.type() == type;
+}
+
+static bool parseUrls(const QJsonObject &obj, const QString &key, QList<QUrl> &urls)
+{
+	if(!isType(obj, key, QJsonValue::Array))
+		return false;
+	for(const auto array = obj.value(key).toArray(); const auto &url: array)
+	{
+		if(!url.isString())
+			return false;
+		urls.append(QUrl(url.toString()));
+	}
+	return true;
+}
+
+QString UpdaterConfig::Package::fileName() const
+{
+	return mirrors.value(0).fileName();
+}
+
+bool UpdaterConfig::Package::parse(const QJsonObject &obj, const QString &prefix, Package &package)
+{
+	const QString download = prefix + "DOWNLOAD"_L1, compressed = prefix + "DOWNLOAD-GZ"_L1;
+	for(const QString &key: {prefix + "LATEST"_L1, prefix + "UPGRADECODE"_L1, download, compressed, compressed + "-SHA256"_L1})
+	{
+		if(!isType(obj, key, QJsonValue::String))
+			return false;
+	}
+	package.latest = obj.value(prefix + "LATEST"_L1).toString();
+	package.upgradeCode = obj.value(prefix + "UPGRADECODE"_L1).toString();
+	package.mirrors = { QUrl(obj.value(download).toString()) };
+	package.compressed.clear();
+	package.compressedHash = QByteArray::fromHex(obj.value(compressed + "-SHA256"_L1).toString().toLatin1());
+	if(!parseUrls(obj, prefix + "MIRRORS"_L1, package.mirrors))
+		return false;
+	if(!obj.contains(compressed) || package.compressedHash.isEmpty())
+		return true;
+	package.compressed = { QUrl(obj.value(compressed).toString()) };
+	return parseUrls(obj, prefix + "MIRRORS-GZ"_L1, package.compressed);
+}
+
+QList<QSslCertificate> UpdaterConfig::certificates() const
+{
+	if(decoded)
+		return certs;
+	certs.clear();
+	for(const QString &cert: certBundle)
+		certs.append(QSslCertificate(QByteArray::fromBase64(cert.toLatin1()), QSsl::Der));
+	decoded = true;
+	return certs;
+}
+
+bool UpdaterConfig::update(const QJsonObject &obj)
+{
+	if(!isType(obj, "META-INF"_L1, QJsonValue::Object) ||
+		!isType(obj, "CERT-BUNDLE"_L1, QJsonValue::Array) ||
+		!isType(obj, "WIN-MESSAGE"_L1, QJsonValue::String) ||
+		!isType(obj, "UPDATER-MESSAGE-URL"_L1, QJsonValue::String))
+		return false;
+	Package nextPackage;
+	if(!Package::parse(obj, u"WIN-"_s, nextPackage) || !isType(obj, "WIN-COMPONENTS"_L1, QJsonValue::Array))
+		return false;
+	QList<Package> nextComponents;
+	for(const auto array = obj.value("WIN-COMPONENTS"_L1).toArray(); const auto &value: array)
+	{
+		QJsonObject component = value.toObject();
+		Package &c = nextComponents.emplaceBack();
+		// Installed version is looked up by upgrade code, an empty code would match unrelated products
+		if(!value.isObject() || !Package::parse(component, {}, c) || c.upgradeCode.isEmpty() ||
+			!component.value("NAME"_L1).isString() || !isType(component, "DEPENDS"_L1, QJsonValue::Array))
+			return false;
+		c.name = component.value("NAME"_L1).toString();
+		for(const auto depends = component.value("DEPENDS"_L1).toArray(); const auto &name: depends)
+		{
+			if(!name.isString())
+				return false;
+			c.depends.append(name.toString());
+		}
+	}
+	QStringList nextBundle;
+	for(const auto array = obj.value("CERT-BUNDLE"_L1).toArray(); const auto &cert: array)
+	{
+		if(!cert.isString())
+			return false;
+		nextBundle.append(cert.toString());
+	}
+
+	package = std::move(nextPackage);
+	components = std::move(nextComponents);
+	message = obj.value("WIN-MESSAGE"_L1).toString();
+	messageUrl = obj.value("UPDATER-MESSAGE-URL"_L1).toString();
+	// Certificate bundle changes only with a new config SERIAL, keep decoded certificates until then
+	int nextSerial = obj.value("META-INF"_L1).toObject().value("SERIAL"_L1).toInt(-1);
+	if(decoded && nextSerial == serial && nextSerial != -1)
+		return true;
+	serial = nextSerial;
+	certBundle = std::move(nextBundle);
+	decoded = false;
+	return true;
+}
@@ -0,0 +1,34 @@
+/*
+ * id-updater
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#pragma once
+
+#include <QCoreApplication>
+#include <QStringList>
+
+/**
+ * User-Agent of the updater requests, the server statistics group clients by it.
+ * Shared with the load simulator, so simulated requests look like the updater.
+ */
+inline QString userAgent(const QString &os, const QString &language, const QStringList &devices)
+{
+	using namespace Qt::StringLiterals;
+	return "%1/%2 (%3) Lang: %4 Devices: %5"_L1.arg(QCoreApplication::applicationName(),
+		QCoreApplication::applicationVersion(), os, language, devices.join('/'));
+}
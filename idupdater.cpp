@@ -19,25 +19,35 @@
 
 #include "idupdater.h"
 
+#include "Application.h"
+#include "Downloader.h"
+#include "InstallGate.h"
+#include "InstallScheduler.h"
+#include "LocalSource.h"
+#include "UserAgent.h"
 #include "common/Common.h"
 #include "common/Configuration.h"
 
 #include <QDebug>
 #include <QDir>
 #include <QElapsedTimer>
-#include <QJsonArray>
+#include <QFileInfo>
 #include <QJsonObject>
 #include <QNetworkReply>
+#include <QPointer>
 #include <QProcess>
 #include <QPushButton>
 #include <QSettings>
 #include <QScopedPointer>
 #include <QSslCertificate>
+#include <QThreadPool>
 #include <QUrl>
 #include <QVersionNumber>
+#include <QWinEventNotifier>
 
 #include <qt_windows.h>
 #include <Msi.h>
+#include <shellapi.h>
 #include <Softpub.h>
 
 using namespace Qt::StringLiterals;
@@ -45,6 +55,7 @@ using namespace Qt::StringLiterals;
 idupdaterui::idupdaterui( const QString &version, idupdater *parent )
 :	QWidget()
 {
+	Application::loadUi();
 	setupUi( this );
 	m_message->hide();
 	connect( parent, &idupdater::status, m_updateStatus, &QLabel::setText );
@@ -79,11 +90,11 @@ void idupdaterui::setInfo( const QString &version, const QString &available )
 	m_availableVer->setText( available );
 }
 
-void idupdaterui::setProgress( QNetworkReply *reply )
+void idupdaterui::setProgress(Downloader *download)
 {
 	buttonBox->button( QDialogButtonBox::Ok )->setEnabled( false );
 	m_downloadProgress->setValue( 0 );
-	connect( reply, &QNetworkReply::downloadProgress, this, [&]( qint64 recvd, qint64 total ) {
+	connect(download, &Downloader::downloadProgress, this, [&](qint64 recvd, qint64 total) {
 		static QElapsedTimer timer;
 		static qint64 lastRecvd = 0;
 		if( timer.hasExpired( 1000 ) )
@@ -104,9 +115,7 @@ idupdater::idupdater( QObject *parent )
 	, version(installedVersion("{f1c4d351-269d-4bee-8cdb-6ea70c968875}"))
 	, conf(new Configuration(this))
 {
-	QString userAgent = "%1/%2 (%3) Lang: %4 Devices: %5"_L1
-		.arg(QApplication::applicationName(), QApplication::applicationVersion(), Common::applicationOs(),
-			QLocale().uiLanguages().first(), Common::drivers().join('/'));
+	QString userAgent = userAgent(Common::applicationOs(), QLocale().uiLanguages().first(), Common::drivers());
 	qDebug() << "User-Agent:" << userAgent;
 	request.setRawHeader( "User-Agent", userAgent.toUtf8() );
 	connect(conf, &Configuration::finished, this, &idupdater::finished);
@@ -128,21 +137,35 @@ idupdater::idupdater( QObject *parent )
 		}
 		reply->ignoreSslErrors(ignore);
 	});
+	setSource(QSettings().value(u"Source"_s).toString());
 }
 
-void idupdater::checkUpdates(bool autoupdate, bool autoclose)
+idupdater::~idupdater() = default;
+
+void idupdater::checkUpdates(bool autoupdate, bool autoclose, bool prestage)
 {
 	m_autoupdate = autoupdate;
 	m_autoclose = autoclose;
+	m_prestage = prestage || QSettings().value(u"PreStage"_s).toBool();
 	if(!autoclose && !w)
 	{
 		w = new idupdaterui(version, this);
 		request.setRawHeader("User-Agent", request.rawHeader( "User-Agent" ) + " manual");
 	}
 	emit status(tr("Checking for update.."));
+	if(local)
+		return finished(false, local->load(conf->object()));
 	conf->update();
 }
 
+void idupdater::setSource(const QString &source)
+{
+	if(source.isEmpty())
+		return local.reset();
+	qDebug() << "Using update repository" << source;
+	local = std::make_unique<LocalSource>(source);
+}
+
 void idupdater::finished(bool /*changed*/, const QString &err)
 {
 	if(!err.isEmpty())
@@ -150,17 +173,23 @@ void idupdater::finished(bool /*changed*/, const QString &err)
 
 	emit status(tr("Check completed"));
 
-	QJsonObject obj = conf->object();
-	trusted.clear();
-	for(const auto array = conf->object().value("CERT-BUNDLE"_L1).toArray(); const auto &c: array)
-		trusted.append(QSslCertificate(QByteArray::fromBase64(c.toString().toLatin1()), QSsl::Der));
-	if(obj.contains("UPDATER-MESSAGE-URL"_L1))
+	if(!config.update(local ? local->object() : conf->object()))
+		return emit error(tr("Invalid configuration"));
+	Application::logMemory("check");
+	if(local)
+	{
+		local->resolve(config.package);
+		for(UpdaterConfig::Package &component: config.components)
+			local->resolve(component);
+	}
+	if(!config.messageUrl.isEmpty())
 	{
 		QSslConfiguration ssl = QSslConfiguration::defaultConfiguration();
-		ssl.setCaCertificates(trusted);
+		ssl.setCaCertificates(config.certificates());
 		auto copy = request;
 		copy.setSslConfiguration(ssl);
-		copy.setUrl(obj.value("UPDATER-MESSAGE-URL"_L1).toString());
+		copy.setTransferTimeout(std::chrono::seconds(10));
+		copy.setUrl(config.messageUrl);
 		QNetworkReply *reply = get(copy);
 		connect(reply, &QNetworkReply::finished, this, [this, reply]{
 			if(reply->error() == QNetworkReply::NoError)
@@ -168,16 +197,36 @@ void idupdater::finished(bool /*changed*/, const QString &err)
 			reply->deleteLater();
 		});
 	}
-	else if(obj.contains("WIN-MESSAGE"_L1))
-		emit message(obj.value("WIN-MESSAGE"_L1).toString());
+	else if(!config.message.isEmpty())
+		emit message(config.message);
 
-	if(obj.contains("WIN-UPGRADECODE"_L1))
-		version = installedVersion(obj.value("WIN-UPGRADECODE"_L1).toString());
-	QString available = obj.value("WIN-LATEST"_L1).toString();
-	request.setUrl(obj.value("WIN-DOWNLOAD"_L1).toString());
+	if(!config.package.upgradeCode.isEmpty())
+		version = installedVersion(config.package.upgradeCode);
+	const QString &available = config.package.latest;
 	qDebug() << "Installed version" << version << "available version" << available;
 
+	outdated.clear();
 	if(!lessThanVersion(version, available))
+	{
+		for(const UpdaterConfig::Package &component: config.components)
+		{
+			QString installed = installedVersion(component.upgradeCode, false);
+			qDebug() << "Component" << component.name << "installed version" << installed << "available version" << component.latest;
+			if(!installed.isEmpty() && lessThanVersion(installed, component.latest))
+				outdated.append(component);
+		}
+	}
+	if(!outdated.isEmpty())
+	{
+		if(m_autoupdate)
+			startInstall();
+		else
+		{
+			if( !w ) w = new idupdaterui(version, this);
+			emit status(tr("Component updates are available"));
+		}
+	}
+	else if(!lessThanVersion(version, available))
 	{
 		emit status(tr("No updates are available"));
 		if(m_autoclose)
@@ -189,14 +238,22 @@ void idupdater::finished(bool /*changed*/, const QString &err)
 		{
 			if( !w ) w = new idupdaterui(version, this);
 			emit status(tr("Update is available"));
+			if(!staged.isEmpty() && QFileInfo(staged).fileName() != config.package.fileName())
+			{
+				CloseHandle(stagedLock);
+				staged.clear();
+			}
+			if(m_prestage && !downloader && staged.isEmpty())
+				startDownload();
 		}
 		else
 			startInstall();
 	}
 	if(w) w->setInfo(version, available);
+	if(w && !outdated.isEmpty()) w->setDownloadEnabled(true);
 }
 
-QString idupdater::installedVersion(const QString &upgradeCode) const
+QString idupdater::installedVersion(const QString &upgradeCode, bool fallback) const
 {
 	QString code = upgradeCode.toUpper();
 	QSettings s(u"HKEY_LOCAL_MACHINE\\SOFTWARE\\Microsoft\\Windows\\CurrentVersion\\Uninstall"_s, QSettings::Registry32Format);
@@ -208,7 +265,7 @@ QString idupdater::installedVersion(const QString &upgradeCode) const
 	}
 
 	WCHAR prodCode[40];
-	if(ERROR_SUCCESS != MsiEnumRelatedProducts(L"{58A1DBA8-81A2-4D58-980B-4A6174D5B66B}", 0, 0, prodCode))
+	if(ERROR_SUCCESS != MsiEnumRelatedProducts(fallback ? L"{58A1DBA8-81A2-4D58-980B-4A6174D5B66B}" : LPCWSTR(code.utf16()), 0, 0, prodCode))
 		return {};
 
 	DWORD size = 0;
@@ -224,42 +281,197 @@ bool idupdater::lessThanVersion(const QString &current, const QString &available
 	return QVersionNumber::fromString(current) < QVersionNumber::fromString(available);
 }
 
-void idupdater::startInstall()
+void idupdater::installComponents()
 {
-	qDebug() << "Starting install";
-	emit status( tr("Downloading...") );
-	QNetworkReply *reply = get(request);
-	connect(reply, &QNetworkReply::finished, this, [this,reply] {
-		if(reply->error() != QNetworkReply::NoError)
+	if(scheduler)
+		return;
+	emit status(tr("Downloading..."));
+	auto path = [](const UpdaterConfig::Package &package) {
+		return QDir::tempPath() + "/" + package.fileName();
+	};
+	scheduler = new InstallScheduler([this, path](const UpdaterConfig::Package &package, const InstallScheduler::Done &done) {
+		auto *download = new Downloader(this, request, package, this);
+		connect(download, &Downloader::finished, this, [download, done](const QString &err) {
+			download->deleteLater();
+			Application::logMemory("download");
+			done(err);
+		});
+		if(w) w->setProgress(download);
+		download->start(path(package));
+	}, [this, path](const UpdaterConfig::Package &package, const InstallScheduler::Done &done) {
+		// Deny writes until the installer is started, install may wait for idle time
+		Qt::HANDLE lock = lockPackage(path(package));
+		if(lock == INVALID_HANDLE_VALUE)
+			return done(tr("Downloaded package integrity check failed"));
+		locks.append(lock);
+		// Worker gets its own copy of the trusted certificates, config may be updated meanwhile
+		QThreadPool::globalInstance()->start([this, fileName = path(package), certs = config.certificates(),
+				interactive = !m_autoupdate, done] {
+			bool verify = verifyPackage(fileName, certs, interactive);
+			// Log from the main thread, the log file is not synchronised
+			QMetaObject::invokeMethod(this, [fileName, verify, done] {
+				qDebug() << "Package signature" << fileName << (verify ? "OK" : "NOT OK");
+				Application::logMemory("verify");
+				done(verify ? QString() : tr("Downloaded package integrity check failed"));
+			}, Qt::QueuedConnection);
+		});
+	}, [this, path](const UpdaterConfig::Package &package, const InstallScheduler::Done &done) {
+		whenIdle([this, fileName = path(package), done] {
+			emit status(tr("Download finished, starting installation..."));
+			Application::logMemory("install");
+			// ShellExecuteEx asks for elevation like QProcess::startDetached does for the main package
+			// and opens .msi packages with msiexec, the process handle gives the exit code
+			QString nativePath = QDir::toNativeSeparators(fileName);
+			SHELLEXECUTEINFOW info { sizeof(info) };
+			info.fMask = SEE_MASK_NOCLOSEPROCESS | SEE_MASK_NOASYNC;
+			info.lpFile = LPCWSTR(nativePath.utf16());
+			info.lpParameters = m_autoupdate ? L"/quiet" : nullptr;
+			info.nShow = SW_SHOWNORMAL;
+			if(!ShellExecuteExW(&info) || !info.hProcess)
+			{
+				qWarning() << "Failed to start installer" << fileName << GetLastError();
+				return done(tr("Package installation failed"));
+			}
+			auto *notifier = new QWinEventNotifier(info.hProcess, this);
+			connect(notifier, &QWinEventNotifier::activated, this, [notifier, done](HANDLE process) {
+				notifier->setEnabled(false);
+				notifier->deleteLater();
+				DWORD exitCode = ERROR_INSTALL_FAILURE;
+				GetExitCodeProcess(process, &exitCode);
+				CloseHandle(process);
+				done(exitCode == ERROR_SUCCESS || exitCode == ERROR_SUCCESS_REBOOT_REQUIRED ?
+					QString() : tr("Package installation failed"));
+			});
+		});
+	}, this);
+	connect(scheduler, &InstallScheduler::finished, this, [this](const QString &err) {
+		scheduler->deleteLater();
+		scheduler = nullptr;
+		for(Qt::HANDLE lock: std::as_const(locks))
+			CloseHandle(lock);
+		locks.clear();
+		if(!err.isEmpty())
+			return emit error(err);
+		emit status(tr("Package installed"));
+		QApplication::quit();
+	});
+	if(!scheduler->start(outdated))
+		emit error(tr("Invalid configuration"));
+}
+
+void idupdater::install(const QString &filePath)
+{
+	if(m_autoupdate && !(gate && gate->isOpen()))
+		return whenIdle([this, filePath] { install(filePath); });
+	emit status(tr("Download finished, starting installation..."));
+	Application::logMemory("install");
+	if(!QProcess::startDetached(filePath, m_autoupdate ? QStringList("/quiet") : QStringList()))
+		return emit error( tr("Package installation failed"));
+	qDebug() << "Installer started" << clicked.elapsed() << "ms after install was requested";
+	emit status(tr("Package installed"));
+	QApplication::quit();
+}
+
+void idupdater::startDownload()
+{
+	qDebug() << "Starting download" << (m_install ? "" : "in background");
+	const UpdaterConfig::Package &package = config.package;
+	downloader = new Downloader(this, request, package, this);
+	// Background download leaves bandwidth to the user, the limit is lifted when install is requested
+	if(!m_install)
+		downloader->setRateLimit(QSettings().value(u"PreStageRate"_s, 512).toLongLong() * 1024);
+	connect(downloader, &Downloader::finished, this, [this](const QString &err) {
+		QString fileName = downloader->fileName();
+		downloader->deleteLater();
+		downloader = nullptr;
+		if(!err.isEmpty())
 		{
-			emit error(reply->errorString());
-			return reply->deleteLater();
+			qWarning() << "Download failed" << err;
+			if(m_install)
+				emit error(err);
+			return;
 		}
 
-		qDebug() << "Downloaded" << reply->url().toString();
-		emit status(tr("Download finished, starting installation..."));
-		QFile tmp(QDir::tempPath() + "/" + reply->url().fileName());
-		if(!tmp.open(QFile::WriteOnly))
-			return emit error(tr("Downloaded package integrity check failed"));
-
-		tmp.write(reply->readAll());
-		tmp.close();
-		reply->deleteLater();
-
-		bool verify = verifyPackage(tmp.fileName());
-		qDebug() << "Package signature" << (verify ? "OK" : "NOT OK");
-		if(!verify)
-			return emit error( tr("Downloaded package integrity check failed") );
-		if(!QProcess::startDetached( tmp.fileName(),
-				m_autoupdate ? QStringList("/quiet") : QStringList()))
-			return emit error( tr("Package installation failed"));
-		emit status(tr("Package installed"));
-		QApplication::quit();
+		qDebug() << "Downloaded" << fileName;
+		Application::logMemory("download");
+		// Deny writes until the installer is started, the package stays as it was verified
+		stagedLock = lockPackage(fileName);
+		if(stagedLock == INVALID_HANDLE_VALUE)
+			return verified(fileName, false);
+		// Signature check may take seconds, keep it off the UI thread as for components.
+		// Trust prompts are shown only after the user asked to install.
+		m_verifying = true;
+		QThreadPool::globalInstance()->start([self = QPointer(this), fileName, certs = config.certificates(),
+				interactive = m_install && !m_autoupdate] {
+			bool verify = verifyPackage(fileName, certs, interactive);
+			QMetaObject::invokeMethod(qApp, [self, fileName, verify] {
+				if(self)
+					self->verified(fileName, verify);
+			}, Qt::QueuedConnection);
+		});
 	});
-	if( w ) w->setProgress(reply);
+	if(w && m_install) w->setProgress(downloader);
+	downloader->start(QDir::tempPath() + "/" + package.fileName());
+}
+
+void idupdater::verified(const QString &fileName, bool verify)
+{
+	m_verifying = false;
+	qDebug() << "Package signature" << (verify ? "OK" : "NOT OK");
+	Application::logMemory("verify");
+	if(!verify)
+	{
+		if(stagedLock != INVALID_HANDLE_VALUE)
+			CloseHandle(stagedLock);
+		if(m_install)
+			emit error( tr("Downloaded package integrity check failed") );
+		return;
+	}
+	staged = fileName;
+	if(m_install)
+		return install(staged);
+	emit status(tr("Update is downloaded and ready to install"));
+}
+
+void idupdater::startInstall()
+{
+	qDebug() << "Starting install";
+	clicked.start();
+	m_install = true;
+	if(!outdated.isEmpty())
+		return installComponents();
+	if(!staged.isEmpty())
+		return install(staged);
+	// Background verification installs when it completes
+	if(m_verifying)
+		return;
+	emit status( tr("Downloading...") );
+	if(!downloader)
+		return startDownload();
+	downloader->setRateLimit(0);
+	if(w) w->setProgress(downloader);
+}
+
+void idupdater::whenIdle(const std::function<void ()> &action)
+{
+	if(!m_autoupdate || (gate && gate->isOpen()))
+		return action();
+	if(!gate)
+	{
+		gate = new InstallGate(InstallGate::Probes::system(), InstallGate::Policy::fromSettings(), this);
+		emit status(tr("Update is ready, waiting for idle time to install"));
+	}
+	connect(gate, &InstallGate::opened, this, action, Qt::SingleShotConnection);
+	gate->start();
+}
+
+Qt::HANDLE idupdater::lockPackage(const QString &filePath)
+{
+	return CreateFileW(LPCWSTR(QDir::toNativeSeparators(filePath).utf16()), GENERIC_READ,
+		FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
 }
 
-bool idupdater::verifyPackage(const QString &filePath) const
+bool idupdater::verifyPackage(const QString &filePath, const QList<QSslCertificate> &certificates, bool interactive)
 {
 	QString path = QDir::toNativeSeparators(filePath);
 	HCERTSTORE store = nullptr;
@@ -296,14 +508,14 @@ bool idupdater::verifyPackage(const QString &filePath) const
 		(const char*)certContext->pbCertEncoded, certContext->cbCertEncoded ), QSsl::Der);
 	CertFreeCertificateContext(certContext);
 
-	if(!trusted.contains(cert))
+	if(!certificates.contains(cert))
 		return false;
 
 	WINTRUST_FILE_INFO FileData { sizeof(WINTRUST_FILE_INFO) };
 	FileData.pcwszFilePath = LPCWSTR(path.utf16());
 
 	WINTRUST_DATA WinTrustData { sizeof(WinTrustData) };
-	WinTrustData.dwUIChoice = m_autoupdate ? WTD_UI_NONE : WTD_UI_ALL;
+	WinTrustData.dwUIChoice = interactive ? WTD_UI_ALL : WTD_UI_NONE;
 	WinTrustData.fdwRevocationChecks = WTD_REVOKE_NONE;
 	WinTrustData.dwUnionChoice = WTD_CHOICE_FILE;
 	WinTrustData.dwProvFlags = WTD_SAFER_FLAG;
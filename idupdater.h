@@ -21,11 +21,21 @@
 
 #include "ui_idupdater.h"
 
+#include "UpdaterConfig.h"
+
+#include <QElapsedTimer>
 #include <QNetworkAccessManager>
 
 #include <QNetworkRequest>
 
+#include <functional>
+#include <memory>
+
 class Configuration;
+class Downloader;
+class InstallGate;
+class InstallScheduler;
+class LocalSource;
 class idupdater;
 class idupdaterui: public QWidget, private Ui::idupdaterui
 {
@@ -35,7 +45,7 @@ public:
 
 	void setDownloadEnabled( bool enabled );
 	void setInfo( const QString &version, const QString &available );
-	void setProgress( QNetworkReply *reply );
+	void setProgress(Downloader *download);
 };
 
 
@@ -45,8 +55,10 @@ class idupdater : public QNetworkAccessManager
 
 public:
 	explicit idupdater( QObject *parent = 0 );
+	~idupdater();
 
-	void checkUpdates(bool autoupdate, bool autoclose);
+	void checkUpdates(bool autoupdate, bool autoclose, bool prestage = false);
+	void setSource(const QString &source);
 	void startInstall();
 
 	static bool lessThanVersion( const QString &current, const QString &available );
@@ -58,13 +70,27 @@ Q_SIGNALS:
 
 private:
 	void finished(bool changed, const QString &error);
-	QString installedVersion(const QString &upgradeCode) const;
-	bool verifyPackage(const QString &filePath) const;
+	void install(const QString &filePath);
+	void whenIdle(const std::function<void ()> &action);
+	void installComponents();
+	QString installedVersion(const QString &upgradeCode, bool fallback = true) const;
+	void startDownload();
+	void verified(const QString &fileName, bool verify);
+	static Qt::HANDLE lockPackage(const QString &filePath);
+	static bool verifyPackage(const QString &filePath, const QList<QSslCertificate> &certificates, bool interactive);
 
-	bool m_autoupdate = false, m_autoclose = false;
+	bool m_autoupdate = false, m_autoclose = false, m_prestage = false, m_install = false, m_verifying = false;
 	QNetworkRequest request;
-	QString version;
+	QString version, staged;
+	Qt::HANDLE stagedLock {};
+	QList<Qt::HANDLE> locks;
+	QElapsedTimer clicked;
 	Configuration *conf {};
+	Downloader *downloader {};
+	InstallGate *gate {};
+	InstallScheduler *scheduler {};
 	idupdaterui *w {};
-	QList<QSslCertificate> trusted;
+	UpdaterConfig config;
+	std::unique_ptr<LocalSource> local;
+	QList<UpdaterConfig::Package> outdated;
 };
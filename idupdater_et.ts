@@ -31,6 +31,14 @@
         <source>Failed to set schedule, check permissions. Try again with administrator permissions.</source>
         <translation>Viga ajakava seadistamisel, palun kontrolli õigusi. Proovi uuesti administraatori õigustega.</translation>
     </message>
+    <message>
+        <source>download and verify available update in background</source>
+        <translation>laadi saadaolev uuendus taustal alla ja kontrolli seda</translation>
+    </message>
+    <message>
+        <source>use exported update repository directory or file/smb URL</source>
+        <translation>kasuta eksporditud uuenduste hoidla kausta või file/smb URL-i</translation>
+    </message>
 </context>
 <context>
     <name>Configuration</name>
@@ -43,6 +51,40 @@
         <translation>Sinu arvutis on uuem konfiguratsioonifail kui serveris.</translation>
     </message>
 </context>
+<context>
+    <name>Downloader</name>
+    <message>
+        <source>Download address is missing</source>
+        <translation>Allalaadimise aadress puudub</translation>
+    </message>
+    <message>
+        <source>Downloaded file checksum does not match</source>
+        <translation>Allalaaditud faili kontrollsumma ei klapi</translation>
+    </message>
+    <message>
+        <source>Download server responded with status %1</source>
+        <translation>Allalaadimise server vastas olekuga %1</translation>
+    </message>
+    <message>
+        <source>Failed to decompress downloaded file</source>
+        <translation>Allalaaditud faili lahtipakkimine ebaõnnestus</translation>
+    </message>
+</context>
+<context>
+    <name>LocalSource</name>
+    <message>
+        <source>Failed to open update repository %1</source>
+        <translation>Uuenduste hoidlat %1 ei õnnestunud avada</translation>
+    </message>
+    <message>
+        <source>The configuration file located on the server cannot be validated.</source>
+        <translation>Serveris olev konfiguratsioonifail ei valideeru.</translation>
+    </message>
+    <message>
+        <source>Your computer&apos;s configuration file is later than the server has.</source>
+        <translation>Sinu arvutis on uuem konfiguratsioonifail kui serveris.</translation>
+    </message>
+</context>
 <context>
     <name>idupdater</name>
     <message>
@@ -101,6 +143,22 @@
         <source>Cannot create temporary file</source>
         <translation type="unfinished"></translation>
     </message>
+    <message>
+        <source>Update is downloaded and ready to install</source>
+        <translation>Uuendus on alla laaditud ja paigaldamiseks valmis</translation>
+    </message>
+    <message>
+        <source>Component updates are available</source>
+        <translation>Komponentidele on saadaval uuendused</translation>
+    </message>
+    <message>
+        <source>Update is ready, waiting for idle time to install</source>
+        <translation>Uuendus on valmis, paigaldamine ootab arvuti jõudeaega</translation>
+    </message>
+    <message>
+        <source>Invalid configuration</source>
+        <translation>Vigane konfiguratsioon</translation>
+    </message>
 </context>
 <context>
     <name>idupdaterui</name>
@@ -31,6 +31,14 @@
         <source>Failed to set schedule, check permissions. Try again with administrator permissions.</source>
         <translation>Не удалось создать &quot;Назначенное задание&quot;. Попробуйте повторить в правах администратора.</translation>
     </message>
+    <message>
+        <source>download and verify available update in background</source>
+        <translation>загрузить и проверить доступное обновление в фоновом режиме</translation>
+    </message>
+    <message>
+        <source>use exported update repository directory or file/smb URL</source>
+        <translation>использовать экспортированный каталог репозитория обновлений или file/smb URL</translation>
+    </message>
 </context>
 <context>
     <name>Configuration</name>
@@ -43,6 +51,40 @@
         <translation>Находящийся на Вашем компьютере конфигурационный файл новее файла на сервере.</translation>
     </message>
 </context>
+<context>
+    <name>Downloader</name>
+    <message>
+        <source>Download address is missing</source>
+        <translation>Отсутствует адрес загрузки</translation>
+    </message>
+    <message>
+        <source>Downloaded file checksum does not match</source>
+        <translation>Контрольная сумма загруженного файла не совпадает</translation>
+    </message>
+    <message>
+        <source>Download server responded with status %1</source>
+        <translation>Сервер загрузки ответил со статусом %1</translation>
+    </message>
+    <message>
+        <source>Failed to decompress downloaded file</source>
+        <translation>Не удалось распаковать загруженный файл</translation>
+    </message>
+</context>
+<context>
+    <name>LocalSource</name>
+    <message>
+        <source>Failed to open update repository %1</source>
+        <translation>Не удалось открыть репозиторий обновлений %1</translation>
+    </message>
+    <message>
+        <source>The configuration file located on the server cannot be validated.</source>
+        <translation>Находящийся на сервере конфигурационный файл не валидируется.</translation>
+    </message>
+    <message>
+        <source>Your computer&apos;s configuration file is later than the server has.</source>
+        <translation>Находящийся на Вашем компьютере конфигурационный файл новее файла на сервере.</translation>
+    </message>
+</context>
 <context>
     <name>idupdater</name>
     <message>
@@ -101,6 +143,22 @@
         <source>Cannot create temporary file</source>
         <translation type="unfinished"></translation>
     </message>
+    <message>
+        <source>Update is downloaded and ready to install</source>
+        <translation>Обновление загружено и готово к установке</translation>
+    </message>
+    <message>
+        <source>Component updates are available</source>
+        <translation>Доступны обновления компонентов</translation>
+    </message>
+    <message>
+        <source>Update is ready, waiting for idle time to install</source>
+        <translation>Обновление готово, установка ожидает простоя компьютера</translation>
+    </message>
+    <message>
+        <source>Invalid configuration</source>
+        <translation>Недопустимая конфигурация</translation>
+    </message>
 </context>
 <context>
     <name>idupdaterui</name>
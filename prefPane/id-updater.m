@@ -21,7 +21,7 @@
 
 #import <PreferencePanes/PreferencePanes.h>
 
-#include <xar/xar.h>
+#include "xarverify.h"
 
 #undef NSLocalizedString
 #define NSLocalizedString(key, comment) \
@@ -210,11 +210,12 @@
     NSTask *task = [NSTask launchedTaskWithLaunchPath:@"/usr/bin/hdiutil" arguments:args];
     [task waitUntilExit];
     
-    args = @[@"attach", @"-verify", @"-mountpoint", volumePath, tmp];
+    // Package is verified below with TOC, file checksums and signature, full image checksum is not needed
+    args = @[@"attach", @"-noverify", @"-mountpoint", volumePath, tmp];
     task = [NSTask launchedTaskWithLaunchPath:@"/usr/bin/hdiutil" arguments:args];
     [task waitUntilExit];
     if (task.terminationStatus != 0) {
-        self.infoLabel.stringValue = [NSString stringWithFormat:@"Verify failed, status: %i", task.terminationStatus];
+        self.infoLabel.stringValue = [NSString stringWithFormat:@"Attach failed, status: %i", task.terminationStatus];
         return;
     }
 
@@ -223,77 +224,29 @@
     NSString *path = [NSString stringWithFormat:@"%@/%@", volumePath,
                       [paths filteredArrayUsingPredicate:predicate].lastObject];
 
-    xar_t xar = xar_open(path.UTF8String, 0);
-    if (!xar) {
-        self.infoLabel.stringValue = [NSString stringWithFormat:NSLocalizedString(@"Failed to open xar archive: %@", nil), path];
-        return;
-    }
-
-    NSData *certData;
-    xar_signature_t sig = xar_signature_first(xar);
-    xar_signature_t next = xar_signature_next(sig);
-    if(next && strcmp("CMS", xar_signature_type(next)) == 0)
-        sig = next;
-    NSString *signatureType = @(xar_signature_type(sig));
-    NSLog(@"Signature type %@", signatureType);
-    for (int32_t i = 0, count = xar_signature_get_x509certificate_count(sig); i < count; ++i) {
-        uint32_t size = 0;
-        const uint8_t *data = nil;
-        if (xar_signature_get_x509certificate_data(sig, i, &data, &size))
-            continue;
-
-        NSData *der = [NSData dataWithBytesNoCopy:(uint8_t*)data length:size freeWhenDone:NO];
-        if ([update.cert_bundle containsObject:der])
-            certData = [NSData dataWithBytes:(uint8_t*)data length:size]; // Make copy of memory will be lost after xar_close
-    }
-
-    if (!certData) {
-        self.infoLabel.stringValue = NSLocalizedString(@"No matching certificate", nil);
-        xar_close(xar);
-        return;
-    }
-
-    uint8_t *signedData = nil, *signatureData = nil;
-    uint32_t signedDataSize = 0, signatureDataSize = 0;
-    off_t offset = 0;
-    uint8_t err = xar_signature_copy_signed_data(sig, &signedData, &signedDataSize, &signatureData, &signatureDataSize, &offset);
-    NSData *signature = [NSData dataWithBytesNoCopy:signatureData length:signatureDataSize];
-    NSData *data = [NSData dataWithBytesNoCopy:signedData length:signedDataSize];
-    xar_close(xar);
-    if (err) {
-        self.infoLabel.stringValue = NSLocalizedString(@"Failed to copy signature", nil);
-        return;
+    NSArray<NSData*> *bundle = update.cert_bundle;
+    const uint8_t *certs[MAX(bundle.count, 1)];
+    size_t certSizes[MAX(bundle.count, 1)];
+    for (NSUInteger i = 0; i < bundle.count; ++i) {
+        certs[i] = (const uint8_t *)bundle[i].bytes;
+        certSizes[i] = bundle[i].length;
     }
-
-    if([signatureType isEqualToString:@"CMS"]) {
-        if ([Updater verifyCMSSignature:signature data:data cert:certData])
+    XarVerifyStatus status = xar_verify_package(path.fileSystemRepresentation, certs, certSizes, bundle.count);
+    NSLog(@"Package verify status %i", status);
+    switch (status) {
+        case XarVerifyOK:
             [NSTask launchedTaskWithLaunchPath:@"/usr/bin/open" arguments:@[path]];
-        else
-        {
-            NSLog(@"CMS Verify error");
+            break;
+        case XarVerifyOpenFailed:
+        case XarVerifyInvalidArchive:
+            self.infoLabel.stringValue = [NSString stringWithFormat:NSLocalizedString(@"Failed to open xar archive: %@", nil), path];
+            break;
+        case XarVerifyNoMatchingCertificate:
+            self.infoLabel.stringValue = NSLocalizedString(@"No matching certificate", nil);
+            break;
+        default:
             self.infoLabel.stringValue = NSLocalizedString(@"Failed to verify signature", nil);
-        }
-        return;
-    }
-
-    SecCertificateRef certref = SecCertificateCreateWithData(0, (__bridge CFDataRef)certData);
-    SecKeyRef publickey = SecCertificateCopyKey(certref);
-    CFRelease(certref);
-    if (publickey == nil) {
-        self.infoLabel.stringValue = NSLocalizedString(@"Failed to copy public key", nil);
-        return;
-    }
-
-    CFErrorRef error = nil;
-    bool isValid = SecKeyVerifySignature(publickey, kSecKeyAlgorithmRSASignatureDigestPKCS1v15SHA1,
-                                         (__bridge CFDataRef)data, (__bridge CFDataRef)signature, &error);
-    CFRelease(publickey);
-    if (isValid)
-        [NSTask launchedTaskWithLaunchPath:@"/usr/bin/open" arguments:@[path]];
-    else
-    {
-        NSLog(@"Verify error: %@", CFBridgingRelease(error));
-        self.infoLabel.stringValue = NSLocalizedString(@"Failed to verify signature", nil);
+            break;
     }
 }
 
@@ -0,0 +1,279 @@
+/*
+ * id-updater
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "xarverify.h"
+
+#include <libxml/parser.h>
+#include <libxml/tree.h>
+#include <openssl/cms.h>
+#include <openssl/evp.h>
+#include <openssl/rsa.h>
+#include <openssl/x509.h>
+#include <zlib.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+constexpr uint32_t XAR_MAGIC = 0x78617221; // "xar!"
+constexpr size_t XAR_HEADER_SIZE = 28;
+constexpr uint64_t XAR_MAX_TOC_SIZE = 64 * 1024 * 1024;
+
+template<class T, class D>
+static std::unique_ptr<T, D> make_unique_ptr(T *p, D d) noexcept
+{
+	return {p, d};
+}
+
+struct MappedFile
+{
+	const uint8_t *data = nullptr;
+	size_t size = 0;
+
+	explicit MappedFile(const char *path)
+	{
+		int fd = open(path, O_RDONLY);
+		if(fd < 0)
+			return;
+		if(struct stat st {}; fstat(fd, &st) == 0 && st.st_size > 0)
+		{
+			if(void *p = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0); p != MAP_FAILED)
+			{
+				madvise(p, size_t(st.st_size), MADV_SEQUENTIAL);
+				data = static_cast<const uint8_t*>(p);
+				size = size_t(st.st_size);
+			}
+		}
+		close(fd);
+	}
+	~MappedFile()
+	{
+		if(data)
+			munmap(const_cast<uint8_t*>(data), size);
+	}
+	MappedFile(const MappedFile &) = delete;
+	MappedFile& operator=(const MappedFile &) = delete;
+};
+
+struct Range
+{
+	const uint8_t *data = nullptr;
+	size_t size = 0;
+};
+
+static uint64_t readBE(const uint8_t *p, size_t len)
+{
+	uint64_t result = 0;
+	for(size_t i = 0; i < len; ++i)
+		result = (result << 8) | p[i];
+	return result;
+}
+
+static xmlNode* child(const xmlNode *node, std::string_view name)
+{
+	for(xmlNode *n = node ? node->children : nullptr; n; n = n->next)
+	{
+		if(n->type == XML_ELEMENT_NODE && name == (const char*)n->name)
+			return n;
+	}
+	return nullptr;
+}
+
+static std::string content(const xmlNode *node)
+{
+	if(!node)
+		return {};
+	auto value = make_unique_ptr(xmlNodeGetContent(node), xmlFree);
+	return value ? std::string((const char*)value.get()) : std::string();
+}
+
+static std::string style(const xmlNode *node)
+{
+	auto value = make_unique_ptr(xmlGetProp(node, (const xmlChar*)"style"), xmlFree);
+	return value ? std::string((const char*)value.get()) : std::string();
+}
+
+static Range heapRange(const Range &heap, const xmlNode *node, const char *sizeName = "size")
+{
+	std::string offset = content(child(node, "offset"));
+	std::string size = content(child(node, sizeName));
+	if(offset.empty() || size.empty())
+		return {};
+	uint64_t o = std::strtoull(offset.c_str(), nullptr, 10);
+	uint64_t s = std::strtoull(size.c_str(), nullptr, 10);
+	if(o > heap.size || s > heap.size - o)
+		return {};
+	return {heap.data + o, size_t(s)};
+}
+
+static std::vector<unsigned char> digest(const EVP_MD *md, const Range &range)
+{
+	std::vector<unsigned char> result(EVP_MAX_MD_SIZE);
+	unsigned int len = 0;
+	if(!md || EVP_Digest(range.data, range.size, result.data(), &len, md, nullptr) != 1)
+		return {};
+	result.resize(len);
+	return result;
+}
+
+static std::string toHex(const std::vector<unsigned char> &data)
+{
+	static constexpr char hex[] = "0123456789abcdef";
+	std::string result;
+	result.reserve(data.size() * 2);
+	for(unsigned char c: data)
+	{
+		result += hex[c >> 4];
+		result += hex[c & 0x0F];
+	}
+	return result;
+}
+
+static std::vector<unsigned char> fromBase64(std::string data)
+{
+	data.erase(std::remove_if(data.begin(), data.end(), [](unsigned char c) { return std::isspace(c); }), data.end());
+	if(data.empty() || data.size() % 4 != 0)
+		return {};
+	std::vector<unsigned char> result(data.size() / 4 * 3);
+	int len = EVP_DecodeBlock(result.data(), (const unsigned char*)data.data(), int(data.size()));
+	if(len < 0)
+		return {};
+	result.resize(size_t(len) - size_t(std::count(data.end() - 2, data.end(), '=')));
+	return result;
+}
+
+static bool verifyFiles(const Range &heap, const xmlNode *node)
+{
+	for(xmlNode *file = node ? node->children : nullptr; file; file = file->next)
+	{
+		if(file->type != XML_ELEMENT_NODE || std::string_view((const char*)file->name) != "file")
+			continue;
+		if(const xmlNode *data = child(file, "data"))
+		{
+			const xmlNode *checksum = child(data, "archived-checksum");
+			Range range = heapRange(heap, data, "length");
+			if(!checksum || !range.data)
+				return false;
+			std::string expected = content(checksum);
+			std::transform(expected.begin(), expected.end(), expected.begin(), ::tolower);
+			if(toHex(digest(EVP_get_digestbyname(style(checksum).c_str()), range)) != expected)
+				return false;
+		}
+		if(!verifyFiles(heap, file))
+			return false;
+	}
+	return true;
+}
+
+static bool verifyRSA(X509 *cert, const EVP_MD *md, const Range &checksum, const Range &signature)
+{
+	auto ctx = make_unique_ptr(EVP_PKEY_CTX_new(X509_get0_pubkey(cert), nullptr), EVP_PKEY_CTX_free);
+	return ctx &&
+		EVP_PKEY_verify_init(ctx.get()) == 1 &&
+		EVP_PKEY_CTX_set_rsa_padding(ctx.get(), RSA_PKCS1_PADDING) == 1 &&
+		EVP_PKEY_CTX_set_signature_md(ctx.get(), md) == 1 &&
+		EVP_PKEY_verify(ctx.get(), signature.data, signature.size, checksum.data, checksum.size) == 1;
+}
+
+static bool verifyCMS(X509 *cert, const Range &checksum, const Range &signature)
+{
+	const unsigned char *p = signature.data;
+	auto cms = make_unique_ptr(d2i_CMS_ContentInfo(nullptr, &p, long(signature.size)), CMS_ContentInfo_free);
+	auto data = make_unique_ptr(BIO_new_mem_buf(checksum.data, int(checksum.size)), BIO_free);
+	auto certs = make_unique_ptr(sk_X509_new_null(), [](STACK_OF(X509) *s) { sk_X509_free(s); });
+	if(!cms || !data || !certs || !sk_X509_push(certs.get(), cert))
+		return false;
+	if(sk_CMS_SignerInfo_num(CMS_get0_SignerInfos(cms.get())) != 1)
+		return false;
+	// Signer must be the pinned certificate, chain trust is replaced by the certificate bundle
+	return CMS_verify(cms.get(), certs.get(), nullptr, data.get(), nullptr,
+		CMS_BINARY | CMS_NOINTERN | CMS_NO_SIGNER_CERT_VERIFY) == 1;
+}
+
+XarVerifyStatus xar_verify_package(const char *path,
+	const uint8_t *const *certs, const size_t *certSizes, size_t certCount)
+{
+	MappedFile file(path);
+	if(!file.data)
+		return XarVerifyOpenFailed;
+	if(file.size < XAR_HEADER_SIZE || readBE(file.data, 4) != XAR_MAGIC)
+		return XarVerifyInvalidArchive;
+	uint64_t headerSize = readBE(file.data + 4, 2);
+	uint64_t tocCompressed = readBE(file.data + 8, 8);
+	uint64_t tocSize = readBE(file.data + 16, 8);
+	if(headerSize < XAR_HEADER_SIZE || headerSize > file.size ||
+		tocCompressed > file.size - headerSize || tocSize > XAR_MAX_TOC_SIZE)
+		return XarVerifyInvalidArchive;
+	Range toc {file.data + headerSize, size_t(tocCompressed)};
+	Range heap {toc.data + toc.size, size_t(file.size - headerSize - tocCompressed)};
+
+	std::string xml(tocSize, 0);
+	uLongf xmlSize = uLongf(tocSize);
+	if(uncompress((Bytef*)xml.data(), &xmlSize, toc.data, uLong(toc.size)) != Z_OK || xmlSize != tocSize)
+		return XarVerifyInvalidArchive;
+	auto doc = make_unique_ptr(xmlReadMemory(xml.data(), int(xml.size()), nullptr, nullptr, XML_PARSE_NONET), xmlFreeDoc);
+	const xmlNode *root = doc ? xmlDocGetRootElement(doc.get()) : nullptr;
+	const xmlNode *tocNode = child(root, "toc");
+	const xmlNode *checksumNode = child(tocNode, "checksum");
+	if(!checksumNode)
+		return XarVerifyInvalidArchive;
+
+	const EVP_MD *md = EVP_get_digestbyname(style(checksumNode).c_str());
+	Range checksum = heapRange(heap, checksumNode);
+	if(!md || !checksum.data || digest(md, toc) != std::vector<unsigned char>(checksum.data, checksum.data + checksum.size))
+		return XarVerifyChecksumMismatch;
+
+	const xmlNode *signatureNode = child(tocNode, "x-signature");
+	bool isCMS = signatureNode && style(signatureNode) == "CMS";
+	if(!isCMS)
+		signatureNode = child(tocNode, "signature");
+	if(!signatureNode)
+		return XarVerifySignatureFailed;
+	Range signature = heapRange(heap, signatureNode);
+	if(!signature.data)
+		return XarVerifyInvalidArchive;
+
+	std::unique_ptr<X509, decltype(&X509_free)> cert(nullptr, X509_free);
+	for(const xmlNode *n = child(child(child(signatureNode, "KeyInfo"), "X509Data"), "X509Certificate"); n && !cert; n = n->next)
+	{
+		std::vector<unsigned char> der = fromBase64(content(n));
+		for(size_t i = 0; i < certCount && !cert; ++i)
+		{
+			if(der.size() != certSizes[i] || !std::equal(der.cbegin(), der.cend(), certs[i]))
+				continue;
+			const unsigned char *p = der.data();
+			cert.reset(d2i_X509(nullptr, &p, long(der.size())));
+		}
+	}
+	if(!cert)
+		return XarVerifyNoMatchingCertificate;
+
+	if(isCMS ? !verifyCMS(cert.get(), checksum, signature) : !verifyRSA(cert.get(), md, checksum, signature))
+		return XarVerifySignatureFailed;
+	return verifyFiles(heap, tocNode) ? XarVerifyOK : XarVerifyChecksumMismatch;
+}
@@ -0,0 +1,48 @@
+/*
+ * id-updater
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+	XarVerifyOK = 0,
+	XarVerifyOpenFailed,
+	XarVerifyInvalidArchive,
+	XarVerifyChecksumMismatch,
+	XarVerifyNoMatchingCertificate,
+	XarVerifySignatureFailed,
+} XarVerifyStatus;
+
+/**
+ * Verifies xar (pkg) archive at path in a single pass over the memory mapped file:
+ * TOC checksum, RSA or CMS signature of the TOC checksum made with one of the trusted
+ * DER certificates and archived checksums of all files in the heap.
+ */
+XarVerifyStatus xar_verify_package(const char *path,
+	const uint8_t *const *certs, const size_t *certSizes, size_t certCount);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,50 @@
+/*
+ * id-updater
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#pragma once
+
+#include <QFile>
+
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+
+#include <memory>
+
+// Signs configuration like the publishing side with data/config.ecpriv, test binaries embed
+// the matching data/config.ecpub as :/config.ecpub
+inline QByteArray sign(const QByteArray &data)
+{
+	QFile file(QStringLiteral(":/config.ecpriv"));
+	if(!file.open(QFile::ReadOnly))
+		return {};
+	QByteArray key = file.readAll();
+	std::unique_ptr<BIO, decltype(&BIO_free)> bio(BIO_new_mem_buf(key.constData(), int(key.size())), BIO_free);
+	std::unique_ptr<EVP_PKEY, decltype(&EVP_PKEY_free)> pkey(PEM_read_bio_PrivateKey(bio.get(), nullptr, nullptr, nullptr), EVP_PKEY_free);
+	std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> ctx(EVP_MD_CTX_new(), EVP_MD_CTX_free);
+	size_t size = 0;
+	if(!pkey || !ctx || EVP_DigestSignInit(ctx.get(), nullptr, EVP_sha384(), nullptr, pkey.get()) != 1 ||
+		EVP_DigestSign(ctx.get(), nullptr, &size, (const unsigned char*)data.constData(), size_t(data.size())) != 1)
+		return {};
+	QByteArray signature(qsizetype(size), Qt::Uninitialized);
+	if(EVP_DigestSign(ctx.get(), (unsigned char*)signature.data(), &size,
+			(const unsigned char*)data.constData(), size_t(data.size())) != 1)
+		return {};
+	signature.resize(qsizetype(size));
+	return signature;
+}
@@ -0,0 +1,175 @@
+/*
+ * id-updater
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#pragma once
+
+#include <QHash>
+#include <QPointer>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTimer>
+#include <QUrl>
+
+#include <algorithm>
+#include <memory>
+
+#include <zlib.h>
+
+// Gzip stream as published for DOWNLOAD-GZ packages
+inline QByteArray gzip(const QByteArray &data)
+{
+	z_stream zs {};
+	deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY);
+	QByteArray out(qsizetype(deflateBound(&zs, uLong(data.size()))), Qt::Uninitialized);
+	zs.next_in = (Bytef*)data.data();
+	zs.avail_in = uInt(data.size());
+	zs.next_out = (Bytef*)out.data();
+	zs.avail_out = uInt(out.size());
+	deflate(&zs, Z_FINISH);
+	out.resize(qsizetype(zs.total_out));
+	deflateEnd(&zs);
+	return out;
+}
+
+/**
+ * Minimal HTTP/1.1 server serving in-memory files with injected latency and failures.
+ * Rules and statistics are keyed by request target (path and query), so one file can be
+ * served as several mirrors with different behaviour, e.g. /file.bin?mirror=1.
+ */
+class TestServer: public QTcpServer
+{
+public:
+	struct Rule
+	{
+		int latency = 0; // milliseconds before each response, HEAD included
+		int status = 0; // error status served for GET instead of the file
+		qint64 dropAfter = -1; // close connection after so many body bytes of GET
+		qint64 rangeShift = 0; // serve range requests from wrong offset
+		bool ranges = true; // advertise and honour Range requests
+		int failures = -1; // status and dropAfter apply only to so many GET requests, -1 to all
+	};
+	struct Stats
+	{
+		int heads = 0, gets = 0;
+		qint64 bytes = 0;
+		QList<QByteArray> ranges;
+	};
+
+	explicit TestServer(QObject *parent = nullptr)
+		: QTcpServer(parent)
+	{
+		connect(this, &QTcpServer::newConnection, this, [this] {
+			while(QTcpSocket *socket = nextPendingConnection())
+			{
+				auto pending = std::make_shared<QByteArray>();
+				connect(socket, &QTcpSocket::disconnected, socket, &QTcpSocket::deleteLater);
+				connect(socket, &QTcpSocket::readyRead, this, [this, socket, pending] {
+					pending->append(socket->readAll());
+					for(qsizetype end = 0; (end = pending->indexOf("\r\n\r\n")) >= 0;)
+					{
+						QByteArray head = pending->left(end);
+						pending->remove(0, end + 4);
+						handle(socket, head);
+					}
+				});
+			}
+		});
+		listen(QHostAddress::LocalHost);
+	}
+
+	QUrl url(const QString &target) const
+	{
+		return QUrl(QStringLiteral("http://127.0.0.1:%1%2").arg(serverPort()).arg(target));
+	}
+
+	QHash<QString,QByteArray> files; // path -> content
+	QHash<QString,Rule> rules; // target -> rule
+	QHash<QString,Stats> stats; // target -> stats
+	qint64 bytes = 0;
+
+private:
+	void handle(QTcpSocket *socket, const QByteArray &head)
+	{
+		QList<QByteArray> lines = head.split('\n');
+		QList<QByteArray> request = lines.value(0).trimmed().split(' ');
+		QByteArray method = request.value(0), range;
+		QString target = QString::fromLatin1(request.value(1));
+		for(const QByteArray &line: lines.mid(1))
+		{
+			if(line.toLower().startsWith("range:"))
+				range = line.mid(6).trimmed();
+		}
+		Rule &rule = rules[target];
+		Stats &stat = stats[target];
+		bool isHead = method == "HEAD";
+		bool fail = !isHead && rule.failures != 0;
+		if(isHead)
+			++stat.heads;
+		else
+		{
+			++stat.gets;
+			if(!range.isEmpty())
+				stat.ranges.append(range);
+			if(rule.failures > 0)
+				--rule.failures;
+		}
+
+		QByteArray content = files.value(QUrl(target).path());
+		QByteArray status = "200 OK", headers, body = content;
+		qint64 dropAfter = fail ? rule.dropAfter : -1;
+		if(!files.contains(QUrl(target).path()))
+		{
+			status = "404 Not Found";
+			body = "<html><body>Not Found</body></html>";
+		}
+		else if(fail && rule.status != 0)
+		{
+			status = QByteArray::number(rule.status) + " Error";
+			body = QByteArray(4096, 'E');
+		}
+		else if(rule.ranges && range.startsWith("bytes="))
+		{
+			qint64 start = range.mid(6, range.indexOf('-') - 6).toLongLong() + rule.rangeShift;
+			start = std::clamp<qint64>(start, 0, content.size());
+			status = "206 Partial Content";
+			headers += "Content-Range: bytes " + QByteArray::number(start) + '-' +
+				QByteArray::number(content.size() - 1) + '/' + QByteArray::number(content.size()) + "\r\n";
+			body = content.mid(start);
+		}
+		if(rule.ranges)
+			headers += "Accept-Ranges: bytes\r\n";
+		QByteArray response = "HTTP/1.1 " + status + "\r\n" + headers +
+			"Content-Length: " + QByteArray::number(body.size()) + "\r\n\r\n";
+		if(!isHead)
+		{
+			if(dropAfter >= 0)
+				body.truncate(dropAfter);
+			response += body;
+			stat.bytes += body.size();
+			bytes += body.size();
+		}
+		QTimer::singleShot(rule.latency, socket, [socket = QPointer<QTcpSocket>(socket), response, dropAfter] {
+			if(!socket)
+				return;
+			socket->write(response);
+			if(dropAfter >= 0)
+				socket->disconnectFromHost();
+		});
+	}
+};
@@ -0,0 +1,368 @@
+/*
+ * id-updater
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "Downloader.h"
+#include "LocalSource.h"
+#include "TestKey.h"
+#include "TestServer.h"
+#include "UpdaterConfig.h"
+
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDir>
+#include <QEventLoop>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QNetworkAccessManager>
+#include <QProcess>
+#include <QRandomGenerator>
+#include <QSettings>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <QTimer>
+
+#include <malloc.h>
+
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <functional>
+
+using namespace Qt::StringLiterals;
+using namespace std::chrono_literals;
+
+/**
+ * Memory budget of the update check, package download and package verification.
+ * Allocations are counted per phase run, heap is the peak of live heap bytes and RSS
+ * the peak resident set growth during the phase. Raise a budget only together with
+ * the change that needs it.
+ *
+ * Budgets are the measured peaks of the CI Linux job plus MARGIN percent. To refresh them run
+ * bench_Memory --baseline there, it prints the measured values and the BUDGETS table to copy here.
+ */
+struct Budget
+{
+	const char *phase;
+	qint64 allocations;
+	qint64 heap;
+	qint64 rss; // -1 when not enforced
+};
+
+constexpr qint64 KiB = 1024, MiB = 1024 * KiB;
+constexpr qint64 PACKAGE_SIZE = 64 * MiB;
+constexpr int CHECK_ROUNDS = 20;
+constexpr int BASELINE_RUNS = 5;
+constexpr int MARGIN = 25; // percent, covers allocator and Qt patch release differences
+// Provisional ceilings until the first baseline of the CI job is recorded
+constexpr Budget BUDGETS[] {
+	{"check", 5000, 512 * KiB, 8 * MiB},
+	// Package may not be held in memory, only the reply read buffer and chunks in flight
+	{"download", 100000, 16 * MiB, 32 * MiB},
+	// Checksum maps the package, mapped pages count towards RSS but not the heap
+	{"verify", 100, 1 * MiB, -1},
+};
+
+// glibc allocator entry points, every malloc family call of the process is counted
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+void __libc_free(void *ptr);
+}
+
+static std::atomic<qint64> allocations {0}, live {0}, peak {0};
+
+static void *allocated(void *ptr)
+{
+	if(!ptr)
+		return ptr;
+	++allocations;
+	qint64 now = live += qint64(malloc_usable_size(ptr));
+	for(qint64 p = peak; now > p && !peak.compare_exchange_weak(p, now);) {}
+	return ptr;
+}
+
+extern "C" {
+void *malloc(size_t size) noexcept
+{
+	return allocated(__libc_malloc(size));
+}
+
+void *calloc(size_t count, size_t size) noexcept
+{
+	return allocated(__libc_calloc(count, size));
+}
+
+void *realloc(void *ptr, size_t size) noexcept
+{
+	qint64 previous = ptr ? qint64(malloc_usable_size(ptr)) : 0;
+	live -= previous;
+	void *result = __libc_realloc(ptr, size);
+	if(!result && ptr && size)
+	{
+		live += previous;
+		return result;
+	}
+	return allocated(result);
+}
+
+void *memalign(size_t alignment, size_t size) noexcept
+{
+	return allocated(__libc_memalign(alignment, size));
+}
+
+void *aligned_alloc(size_t alignment, size_t size) noexcept
+{
+	return allocated(__libc_memalign(alignment, size));
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size) noexcept
+{
+	*ptr = allocated(__libc_memalign(alignment, size));
+	return *ptr ? 0 : ENOMEM;
+}
+
+void free(void *ptr) noexcept
+{
+	if(ptr)
+		live -= qint64(malloc_usable_size(ptr));
+	__libc_free(ptr);
+}
+}
+
+struct Usage
+{
+	qint64 allocations = 0, heap = 0, rss = 0;
+};
+
+static qint64 procStatus(QByteArrayView key)
+{
+	QFile file(u"/proc/self/status"_s);
+	if(!file.open(QFile::ReadOnly))
+		return 0;
+	for(const QByteArray &line: file.readAll().split('\n'))
+	{
+		if(line.startsWith(key))
+			return line.mid(key.size()).trimmed().split(' ').value(0).toLongLong() * KiB;
+	}
+	return 0;
+}
+
+static Usage measure(const std::function<void ()> &phase, int rounds = 1)
+{
+	// Reset peak RSS (VmHWM) to the current RSS
+	if(QFile refs(u"/proc/self/clear_refs"_s); refs.open(QFile::WriteOnly))
+		refs.write("5");
+	qint64 rss = procStatus("VmRSS:");
+	qint64 heap = live;
+	peak = heap;
+	allocations = 0;
+	phase();
+	Usage usage {allocations / rounds, peak - heap, 0};
+	usage.rss = std::max<qint64>(0, procStatus("VmHWM:") - rss);
+	return usage;
+}
+
+static QString fetch(QNetworkAccessManager *manager, const QUrl &url, const QByteArray &checksum, const QString &filePath)
+{
+	Downloader download(manager, {}, QList<QUrl>{url});
+	download.setChecksum(checksum);
+	QEventLoop loop;
+	QString result = u"timeout"_s;
+	bool done = false;
+	QObject::connect(&download, &Downloader::finished, &loop, [&](const QString &error) {
+		result = error;
+		done = true;
+		loop.quit();
+	});
+	QTimer::singleShot(60s, &loop, &QEventLoop::quit);
+	download.start(filePath);
+	if(!done)
+		loop.exec();
+	return result;
+}
+
+static QByteArray config(const QUrl &url)
+{
+	QJsonArray components;
+	for(const QString &name: {u"plugin"_s, u"driver"_s})
+	{
+		components.append(QJsonObject{
+			{u"NAME"_s, name},
+			{u"LATEST"_s, u"2.0.0"_s},
+			{u"UPGRADECODE"_s, u"{00000000-0000-0000-0000-000000000002}"_s},
+			{u"DOWNLOAD"_s, url.resolved(QUrl(name + ".msi"_L1)).toString()},
+		});
+	}
+	return QJsonDocument(QJsonObject{
+		{u"META-INF"_s, QJsonObject{
+			{u"SERIAL"_s, 1},
+			{u"DATE"_s, QDateTime::currentDateTimeUtc().addDays(-1).toString(u"yyyyMMddHHmmss'Z'"_s)},
+		}},
+		{u"WIN-LATEST"_s, u"1.0.0"_s},
+		{u"WIN-UPGRADECODE"_s, u"{00000000-0000-0000-0000-000000000001}"_s},
+		{u"WIN-DOWNLOAD"_s, url.toString()},
+		{u"WIN-MIRRORS"_s, QJsonArray{url.toString()}},
+		{u"WIN-COMPONENTS"_s, components},
+	}).toJson();
+}
+
+int main(int argc, char *argv[])
+{
+	QCoreApplication app(argc, argv);
+	app.setOrganizationName(u"RIA"_s);
+	app.setApplicationName(u"id-updater-bench"_s);
+	QStringList args = app.arguments();
+
+	// Server runs in a child process, so its buffers are not counted
+	if(args.value(1) == "--serve"_L1)
+	{
+		TestServer server;
+		QFile file(args.value(2));
+		if(!server.isListening() || !file.open(QFile::ReadOnly))
+			return 1;
+		server.files.insert(u"/package.msi"_s, file.readAll());
+		server.files.insert(u"/warmup.msi"_s, QByteArray(64 * KiB, 'w'));
+		QTextStream(stdout) << server.serverPort() << Qt::endl;
+		return app.exec();
+	}
+
+	QTemporaryDir dir;
+	if(!dir.isValid())
+		return 1;
+	QSettings::setDefaultFormat(QSettings::IniFormat);
+	QSettings::setPath(QSettings::IniFormat, QSettings::UserScope, dir.path());
+	QString package = dir.filePath(u"package.msi"_s);
+	if(QFile file(package); file.open(QFile::WriteOnly))
+	{
+		QByteArray block(MiB, Qt::Uninitialized);
+		QRandomGenerator random(1);
+		for(qint64 i = 0; i < PACKAGE_SIZE; i += block.size())
+		{
+			random.fillRange((quint32*)block.data(), block.size() / sizeof(quint32));
+			file.write(block);
+		}
+	}
+	QByteArray checksum = LocalSource::checksum(package);
+
+	QProcess server;
+	server.start(QCoreApplication::applicationFilePath(), {u"--serve"_s, package});
+	if(!server.waitForReadyRead(10000))
+	{
+		qWarning() << "Failed to start server" << server.errorString();
+		return 1;
+	}
+	QUrl base(u"http://127.0.0.1:%1/"_s.arg(server.readLine().trimmed().toInt()));
+
+	// Repository with signed configuration as loaded by the update check
+	QString repo = dir.filePath(u"repo"_s);
+	QByteArray json = config(base.resolved(QUrl(u"package.msi"_s)));
+	QDir().mkpath(repo);
+	if(QFile file(QDir(repo).filePath(u"config.json"_s)); file.open(QFile::WriteOnly))
+		file.write(json);
+	if(QFile file(QDir(repo).filePath(u"config.ecc"_s)); file.open(QFile::WriteOnly))
+		file.write(sign(json).toBase64());
+	QString error;
+	auto check = [&] {
+		LocalSource source(repo);
+		UpdaterConfig config;
+		if(QString err = source.load(); !err.isEmpty() || !config.update(source.object()))
+			error = err.isEmpty() ? u"Invalid configuration"_s : err;
+	};
+
+	// Warm up one-time initialization of OpenSSL, settings and the network thread
+	QNetworkAccessManager manager;
+	check();
+	if(QString err = fetch(&manager, base.resolved(QUrl(u"warmup.msi"_s)), {}, dir.filePath(u"warmup.msi"_s)); !err.isEmpty())
+		error = err;
+	if(!error.isEmpty())
+	{
+		qWarning() << "Warm up failed:" << error;
+		return 1;
+	}
+
+	QString target = dir.filePath(u"download.msi"_s);
+	// Baseline is the highest value of several runs, the enforced budget check runs once
+	bool baseline = args.contains("--baseline"_L1);
+	std::array<Usage,std::size(BUDGETS)> usages;
+	for(int run = 0; run < (baseline ? BASELINE_RUNS : 1) && error.isEmpty(); ++run)
+	{
+		const Usage current[] {
+			measure([&] {
+				for(int i = 0; i < CHECK_ROUNDS; ++i)
+					check();
+			}, CHECK_ROUNDS),
+			measure([&] {
+				if(QString err = fetch(&manager, base.resolved(QUrl(u"package.msi"_s)), checksum, target); !err.isEmpty())
+					error = err;
+			}),
+			measure([&] {
+				if(LocalSource::checksum(target) != checksum)
+					error = u"Checksum does not match"_s;
+			}),
+		};
+		for(size_t i = 0; i < usages.size(); ++i)
+		{
+			usages[i].allocations = std::max(usages[i].allocations, current[i].allocations);
+			usages[i].heap = std::max(usages[i].heap, current[i].heap);
+			usages[i].rss = std::max(usages[i].rss, current[i].rss);
+		}
+	}
+	server.kill();
+	server.waitForFinished();
+	if(!error.isEmpty())
+	{
+		qWarning() << "Benchmark failed:" << error;
+		return 1;
+	}
+
+	QTextStream out(stdout);
+	if(baseline)
+	{
+		auto budget = [](qint64 value) { return value * (100 + MARGIN) / 100; };
+		for(size_t i = 0; i < std::size(BUDGETS); ++i)
+			out << BUDGETS[i].phase << ": " << usages[i].allocations << " allocations, peak heap " << usages[i].heap
+				<< " bytes, peak RSS +" << usages[i].rss << " bytes" << Qt::endl;
+		out << "constexpr Budget BUDGETS[] {" << Qt::endl;
+		for(size_t i = 0; i < std::size(BUDGETS); ++i)
+		{
+			out << "\t{\"" << BUDGETS[i].phase << "\", " << budget(usages[i].allocations) << ", "
+				<< budget(usages[i].heap) << ", " << (BUDGETS[i].rss >= 0 ? budget(usages[i].rss) : -1) << "}," << Qt::endl;
+		}
+		out << "};" << Qt::endl;
+		return 0;
+	}
+	bool exceeded = false;
+	for(size_t i = 0; i < std::size(BUDGETS); ++i)
+	{
+		const Budget &budget = BUDGETS[i];
+		const Usage &usage = usages[i];
+		bool over = usage.allocations > budget.allocations || usage.heap > budget.heap ||
+			(budget.rss >= 0 && usage.rss > budget.rss);
+		exceeded |= over;
+		out << budget.phase << ": " << usage.allocations << '/' << budget.allocations << " allocations, peak heap "
+			<< usage.heap / KiB << '/' << budget.heap / KiB << " KiB, peak RSS +" << usage.rss / KiB;
+		if(budget.rss >= 0)
+			out << '/' << budget.rss / KiB;
+		out << " KiB" << (over ? " OVER BUDGET" : "") << Qt::endl;
+	}
+	return exceeded ? 1 : 0;
+}
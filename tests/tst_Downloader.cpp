@@ -0,0 +1,325 @@
+/*
+ * id-updater
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "Downloader.h"
+#include "TestServer.h"
+
+#include <QElapsedTimer>
+#include <QNetworkAccessManager>
+#include <QRandomGenerator>
+#include <QSettings>
+#include <QSignalSpy>
+#include <QTemporaryDir>
+#include <QTest>
+#include <QTimer>
+
+#include <ctime>
+#include <limits>
+
+using namespace Qt::StringLiterals;
+
+class DownloaderTest: public QObject
+{
+	Q_OBJECT
+private Q_SLOTS:
+	void initTestCase();
+	void init();
+	void download();
+	void errorBodyIsNotWritten();
+	void resumeAfterDrop();
+	void wrongContentRange();
+	void preferLowLatency();
+	void checksumMismatch();
+	void compressedFallback();
+	void rateLimit();
+	void compression();
+
+private:
+	QString run(Downloader &download);
+	QByteArray content() const;
+
+	QTemporaryDir dir;
+	QNetworkAccessManager manager;
+	TestServer server;
+	QByteArray data;
+	QByteArray sha256;
+};
+
+void DownloaderTest::initTestCase()
+{
+	QVERIFY(dir.isValid());
+	QVERIFY(server.isListening());
+	QCoreApplication::setOrganizationName(u"RIA"_s);
+	QCoreApplication::setApplicationName(u"id-updater-test"_s);
+	QSettings::setDefaultFormat(QSettings::IniFormat);
+	QSettings::setPath(QSettings::IniFormat, QSettings::UserScope, dir.path());
+	data.resize(4 * 1024 * 1024);
+	QRandomGenerator(1).fillRange((quint32*)data.data(), data.size() / sizeof(quint32));
+	sha256 = QCryptographicHash::hash(data, QCryptographicHash::Sha256);
+	server.files.insert(u"/package.msi"_s, data);
+}
+
+void DownloaderTest::init()
+{
+	// Mirror statistics of previous cases would change probe order
+	QSettings().remove(u"Mirrors"_s);
+	server.rules.clear();
+	server.stats.clear();
+	server.bytes = 0;
+	manager.clearConnectionCache();
+}
+
+QString DownloaderTest::run(Downloader &download)
+{
+	QSignalSpy spy(&download, &Downloader::finished);
+	download.start(dir.filePath(u"package.msi"_s));
+	if(spy.isEmpty() && !spy.wait(60000))
+		return u"timeout"_s;
+	return spy.first().first().toString();
+}
+
+QByteArray DownloaderTest::content() const
+{
+	QFile file(dir.filePath(u"package.msi"_s));
+	return file.open(QFile::ReadOnly) ? file.readAll() : QByteArray();
+}
+
+void DownloaderTest::download()
+{
+	Downloader download(&manager, {}, QList<QUrl>{server.url(u"/package.msi"_s)});
+	download.setChecksum(sha256);
+	QCOMPARE(run(download), QString());
+	QCOMPARE(content(), data);
+	QCOMPARE(server.bytes, qint64(data.size()));
+}
+
+void DownloaderTest::errorBodyIsNotWritten()
+{
+	// First mirror drops the connection halfway, second answers with an error page,
+	// first mirror must be resumed from the bytes received before the error page
+	server.rules[u"/package.msi?mirror=1"_s] = {.dropAfter = data.size() / 2, .failures = 1};
+	server.rules[u"/package.msi?mirror=2"_s] = {.latency = 200, .status = 503};
+	Downloader download(&manager, {}, QList<QUrl>{
+		server.url(u"/package.msi?mirror=1"_s), server.url(u"/package.msi?mirror=2"_s)});
+	download.setChecksum(sha256);
+	QCOMPARE(run(download), QString());
+	QCOMPARE(content(), data);
+	QCOMPARE(server.stats[u"/package.msi?mirror=2"_s].gets, 1);
+	const TestServer::Stats &first = server.stats[u"/package.msi?mirror=1"_s];
+	QCOMPARE(first.gets, 2);
+	QCOMPARE(first.ranges.size(), 1);
+	QVERIFY(first.ranges.first().startsWith("bytes="));
+	QVERIFY(first.ranges.first() != "bytes=0-");
+}
+
+void DownloaderTest::resumeAfterDrop()
+{
+	server.rules[u"/package.msi"_s] = {.latency = 50, .dropAfter = data.size() / 3, .failures = 1};
+	Downloader download(&manager, {}, QList<QUrl>{server.url(u"/package.msi"_s)});
+	download.setChecksum(sha256);
+	QCOMPARE(run(download), QString());
+	QCOMPARE(content(), data);
+	const TestServer::Stats &stats = server.stats[u"/package.msi"_s];
+	QCOMPARE(stats.gets, 2);
+	QCOMPARE(stats.ranges.size(), 1);
+	// Only the missing part is transferred again
+	QVERIFY(server.bytes < data.size() * 4 / 3);
+}
+
+void DownloaderTest::wrongContentRange()
+{
+	// Second mirror answers range requests from another offset, the response must be rejected
+	server.rules[u"/package.msi?mirror=1"_s] = {.dropAfter = data.size() / 2, .failures = 1};
+	server.rules[u"/package.msi?mirror=2"_s] = {.latency = 200, .rangeShift = 1000};
+	Downloader download(&manager, {}, QList<QUrl>{
+		server.url(u"/package.msi?mirror=1"_s), server.url(u"/package.msi?mirror=2"_s)});
+	download.setChecksum(sha256);
+	QCOMPARE(run(download), QString());
+	QCOMPARE(content(), data);
+	QCOMPARE(server.stats[u"/package.msi?mirror=2"_s].ranges.size(), 1);
+	QCOMPARE(server.stats[u"/package.msi?mirror=1"_s].ranges.size(), 1);
+
+	// Single mirror keeps failing
+	init();
+	server.rules[u"/package.msi"_s] = {.dropAfter = data.size() / 2, .rangeShift = -1, .failures = 1};
+	Downloader single(&manager, {}, QList<QUrl>{server.url(u"/package.msi"_s)});
+	single.setChecksum(sha256);
+	QCOMPARE(run(single), u"Download server responded with status 206"_s);
+}
+
+void DownloaderTest::preferLowLatency()
+{
+	server.rules[u"/package.msi?mirror=1"_s] = {.latency = 500};
+	server.rules[u"/package.msi?mirror=2"_s] = {.latency = 20};
+	Downloader download(&manager, {}, QList<QUrl>{
+		server.url(u"/package.msi?mirror=1"_s), server.url(u"/package.msi?mirror=2"_s)});
+	download.setChecksum(sha256);
+	QCOMPARE(run(download), QString());
+	QCOMPARE(content(), data);
+	QCOMPARE(server.stats[u"/package.msi?mirror=1"_s].heads, 1);
+	QCOMPARE(server.stats[u"/package.msi?mirror=2"_s].heads, 1);
+	QCOMPARE(server.stats[u"/package.msi?mirror=1"_s].gets, 0);
+	QCOMPARE(server.stats[u"/package.msi?mirror=2"_s].gets, 1);
+	QVERIFY(QSettings().childGroups().contains(u"Mirrors"_s));
+
+	// Probe results are not stored when persistence is disabled
+	init();
+	Downloader memory(&manager, {}, QList<QUrl>{
+		server.url(u"/package.msi?mirror=1"_s), server.url(u"/package.msi?mirror=2"_s)});
+	memory.setChecksum(sha256);
+	memory.setPersistentStats(false);
+	QCOMPARE(run(memory), QString());
+	QCOMPARE(content(), data);
+	QVERIFY(!QSettings().childGroups().contains(u"Mirrors"_s));
+}
+
+void DownloaderTest::checksumMismatch()
+{
+	Downloader download(&manager, {}, QList<QUrl>{server.url(u"/package.msi"_s)});
+	download.setChecksum(QByteArray(32, 0));
+	QCOMPARE(run(download), u"Downloaded file checksum does not match"_s);
+	QCOMPARE(server.stats[u"/package.msi"_s].gets, 2);
+
+	Downloader missing(&manager, {}, QList<QUrl>{server.url(u"/missing.msi"_s)});
+	QVERIFY(!run(missing).isEmpty());
+	QCOMPARE(server.stats[u"/missing.msi"_s].gets, 2);
+}
+
+void DownloaderTest::compressedFallback()
+{
+	UpdaterConfig::Package package;
+	package.mirrors = {server.url(u"/package.msi"_s)};
+	package.checksum = sha256;
+
+	// Compressed variant is missing
+	package.compressed = {server.url(u"/missing.msi.gz"_s)};
+	package.compressedHash = QByteArray(32, 0);
+	Downloader missing(&manager, {}, package);
+	QCOMPARE(run(missing), QString());
+	QCOMPARE(content(), data);
+	QCOMPARE(server.stats[u"/missing.msi.gz"_s].gets, 2);
+	QCOMPARE(server.stats[u"/package.msi"_s].gets, 1);
+
+	// Compressed variant matches its checksum but does not inflate
+	init();
+	QByteArray corrupt = gzip(data.left(1024 * 1024));
+	corrupt[corrupt.size() / 2] ^= 0xFF;
+	server.files.insert(u"/corrupt.msi.gz"_s, corrupt);
+	package.compressed = {server.url(u"/corrupt.msi.gz"_s)};
+	package.compressedHash = QCryptographicHash::hash(corrupt, QCryptographicHash::Sha256);
+	Downloader broken(&manager, {}, package);
+	QCOMPARE(run(broken), QString());
+	QCOMPARE(content(), data);
+	QCOMPARE(server.stats[u"/corrupt.msi.gz"_s].gets, 1);
+
+	// Fallback is checked against the uncompressed checksum
+	init();
+	package.checksum = QByteArray(32, 0);
+	Downloader mismatch(&manager, {}, package);
+	QCOMPARE(run(mismatch), u"Downloaded file checksum does not match"_s);
+	QCOMPARE(server.stats[u"/package.msi"_s].gets, 2);
+}
+
+void DownloaderTest::rateLimit()
+{
+	// 4 MiB at 2 MiB/s, the bucket starts empty and bursts at most one second
+	Downloader download(&manager, {}, QList<QUrl>{server.url(u"/package.msi"_s)});
+	download.setChecksum(sha256);
+	download.setRateLimit(2 * 1024 * 1024);
+	QElapsedTimer timer;
+	timer.start();
+	QCOMPARE(run(download), QString());
+	QCOMPARE(content(), data);
+	qDebug() << "Rate limited download took" << timer.elapsed() << "ms";
+	QVERIFY(timer.elapsed() >= 1500);
+
+	// Lifting the limit lets the rest of the download run at full speed
+	init();
+	Downloader lifted(&manager, {}, QList<QUrl>{server.url(u"/package.msi"_s)});
+	lifted.setChecksum(sha256);
+	lifted.setRateLimit(64 * 1024);
+	QTimer::singleShot(200, &lifted, [&lifted] { lifted.setRateLimit(0); });
+	timer.restart();
+	QCOMPARE(run(lifted), QString());
+	QCOMPARE(content(), data);
+	QVERIFY(timer.elapsed() < 10000);
+}
+
+void DownloaderTest::compression()
+{
+	// Installer like content: already compressed cabinets mixed with tables and resources
+	QByteArray plain;
+	QRandomGenerator random(2);
+	while(plain.size() < 32 * 1024 * 1024)
+	{
+		QByteArray block(64 * 1024, Qt::Uninitialized);
+		if(random.bounded(2) == 0)
+			random.fillRange((quint32*)block.data(), block.size() / sizeof(quint32));
+		else
+			block = QByteArray("Property\tValue\tComponent_%1\r\n").replace("%1", QByteArray::number(random.bounded(100)))
+				.repeated(block.size() / 32).left(block.size());
+		plain += block;
+	}
+	QByteArray compressed = gzip(plain);
+	server.files.insert(u"/bench.msi"_s, plain);
+	server.files.insert(u"/bench.msi.gz"_s, compressed);
+	UpdaterConfig::Package package;
+	package.mirrors = {server.url(u"/bench.msi"_s)};
+	package.compressed = {server.url(u"/bench.msi.gz"_s)};
+	package.checksum = QCryptographicHash::hash(plain, QCryptographicHash::Sha256);
+	package.compressedHash = QCryptographicHash::hash(compressed, QCryptographicHash::Sha256);
+
+	struct Result { qint64 bytes = 0, wall = 0; double cpu = 0; };
+	auto measure = [&](bool useCompressed) {
+		Result best {0, std::numeric_limits<qint64>::max(), std::numeric_limits<double>::max()};
+		for(int round = 0; round < 3; ++round)
+		{
+			init();
+			UpdaterConfig::Package p = package;
+			if(!useCompressed)
+				p.compressed.clear();
+			Downloader download(&manager, {}, p);
+			QElapsedTimer timer;
+			timer.start();
+			std::clock_t cpu = std::clock();
+			if(QString err = run(download); !err.isEmpty())
+				qWarning() << err;
+			best.cpu = std::min(best.cpu, double(std::clock() - cpu) * 1000 / CLOCKS_PER_SEC);
+			best.wall = std::min(best.wall, timer.elapsed());
+			best.bytes = server.bytes;
+		}
+		return best;
+	};
+	Result uncompressed = measure(false);
+	QCOMPARE(content(), plain);
+	Result gz = measure(true);
+	QCOMPARE(content(), plain);
+	QCOMPARE(gz.bytes, qint64(compressed.size()));
+	QVERIFY(gz.bytes < uncompressed.bytes);
+
+	qDebug().nospace() << "Uncompressed: " << uncompressed.bytes << " bytes, " << uncompressed.wall << " ms, "
+		<< uncompressed.cpu << " ms CPU";
+	qDebug().nospace() << "Compressed: " << gz.bytes << " bytes, " << gz.wall << " ms, " << gz.cpu << " ms CPU";
+	qDebug().nospace() << "Saved " << uncompressed.bytes - gz.bytes << " bytes ("
+		<< (uncompressed.bytes - gz.bytes) * 100 / uncompressed.bytes << "%), inflate cost "
+		<< gz.cpu - uncompressed.cpu << " ms CPU";
+}
+
+QTEST_GUILESS_MAIN(DownloaderTest)
+#include "tst_Downloader.moc"
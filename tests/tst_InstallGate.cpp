@@ -0,0 +1,163 @@
+/*
+ * id-updater
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "InstallGate.h"
+
+#include <QElapsedTimer>
+#include <QSignalSpy>
+#include <QTest>
+
+using namespace std::chrono;
+
+class InstallGateTest: public QObject
+{
+	Q_OBJECT
+private Q_SLOTS:
+	void init();
+	void firstInterval();
+	void primedLoad();
+	void blocked_data();
+	void blocked();
+	void deadline();
+	void singleEmission();
+
+private:
+	// Simulated probes returning the current member values
+	InstallGate::Probes probes();
+
+	milliseconds idle;
+	QList<int> loads; // consumed one per sample, last value repeats
+	bool cardInUse = false;
+	int samples = 0;
+	static constexpr InstallGate::Policy policy {.idle = 1s, .interval = 50ms, .deadline = 1h, .load = 50};
+};
+
+void InstallGateTest::init()
+{
+	idle = 10min;
+	loads = {0};
+	cardInUse = false;
+	samples = 0;
+}
+
+InstallGate::Probes InstallGateTest::probes()
+{
+	return {
+		[this] { return idle; },
+		[this] {
+			++samples;
+			return loads.size() > 1 ? loads.takeFirst() : loads.first();
+		},
+		[this] { return cardInUse; },
+	};
+}
+
+void InstallGateTest::firstInterval()
+{
+	// Idle machine is not checked before one interval has passed
+	InstallGate gate(probes(), policy);
+	QSignalSpy spy(&gate, &InstallGate::opened);
+	QElapsedTimer timer;
+	timer.start();
+	gate.start();
+	QVERIFY(!gate.isOpen());
+	QVERIFY(spy.isEmpty());
+	QCOMPARE(samples, 1);
+	QVERIFY(spy.wait());
+	QVERIFY(timer.elapsed() >= 45);
+	QVERIFY(gate.isOpen());
+	QCOMPARE(samples, 2);
+}
+
+void InstallGateTest::primedLoad()
+{
+	// Load since boot is discarded, the first decision uses the load of the first interval
+	loads = {100, 10};
+	InstallGate gate(probes(), policy);
+	QSignalSpy spy(&gate, &InstallGate::opened);
+	gate.start();
+	QVERIFY(spy.wait());
+	QCOMPARE(samples, 2);
+}
+
+void InstallGateTest::blocked_data()
+{
+	QTest::addColumn<int>("load");
+	QTest::addColumn<int>("idleSeconds");
+	QTest::addColumn<bool>("card");
+	QTest::newRow("busy") << 90 << 600 << false;
+	QTest::newRow("user active") << 0 << 0 << false;
+	QTest::newRow("card in use") << 0 << 600 << true;
+}
+
+void InstallGateTest::blocked()
+{
+	QFETCH(int, load);
+	QFETCH(int, idleSeconds);
+	QFETCH(bool, card);
+	loads = {load};
+	idle = seconds(idleSeconds);
+	cardInUse = card;
+	InstallGate gate(probes(), policy);
+	QSignalSpy spy(&gate, &InstallGate::opened);
+	gate.start();
+	QTRY_VERIFY(samples > 3);
+	QVERIFY(!gate.isOpen());
+	QVERIFY(spy.isEmpty());
+
+	// Gate opens on the next check once the machine is free
+	loads = {0};
+	idle = 10min;
+	cardInUse = false;
+	QVERIFY(spy.wait());
+	QVERIFY(gate.isOpen());
+}
+
+void InstallGateTest::deadline()
+{
+	loads = {100};
+	InstallGate::Policy p = policy;
+	p.deadline = 300ms;
+	InstallGate gate(probes(), p);
+	QSignalSpy spy(&gate, &InstallGate::opened);
+	QElapsedTimer timer;
+	timer.start();
+	gate.start();
+	QVERIFY(spy.wait());
+	// Only the lower bound is checked, a loaded machine may run the check later
+	QVERIFY(timer.elapsed() >= 300);
+	QVERIFY(gate.isOpen());
+}
+
+void InstallGateTest::singleEmission()
+{
+	InstallGate gate(probes(), policy);
+	QSignalSpy spy(&gate, &InstallGate::opened);
+	gate.start();
+	QVERIFY(spy.wait());
+	// Open gate stops sampling and is not restarted
+	int count = samples;
+	gate.start();
+	QTest::qWait(200);
+	QCOMPARE(spy.size(), 1);
+	QCOMPARE(samples, count);
+}
+
+QTEST_GUILESS_MAIN(InstallGateTest)
+#include "tst_InstallGate.moc"
@@ -0,0 +1,215 @@
+/*
+ * id-updater
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "InstallScheduler.h"
+
+#include <QElapsedTimer>
+#include <QSignalSpy>
+#include <QTest>
+#include <QThread>
+#include <QThreadPool>
+#include <QTimer>
+
+#include <algorithm>
+#include <atomic>
+
+using namespace Qt::StringLiterals;
+
+class InstallSchedulerTest: public QObject
+{
+	Q_OBJECT
+private Q_SLOTS:
+	void sort();
+	void cycle();
+	void empty();
+	void order();
+	void pipeline();
+	void failure();
+	void synchronous();
+	void deleted();
+
+private:
+	static UpdaterConfig::Package package(const QString &name, const QStringList &depends = {});
+	// Fake stage finishing after delay on the main thread, or in the thread pool when threaded
+	InstallScheduler::Stage stage(const QString &name, int delay, bool threaded = false, const QString &fail = {});
+
+	QStringList events;
+	int active = 0, maxActive = 0;
+	std::atomic<int> running = 0; // stages started and not yet called back
+};
+
+UpdaterConfig::Package InstallSchedulerTest::package(const QString &name, const QStringList &depends)
+{
+	UpdaterConfig::Package p;
+	p.name = name;
+	p.depends = depends;
+	return p;
+}
+
+InstallScheduler::Stage InstallSchedulerTest::stage(const QString &name, int delay, bool threaded, const QString &fail)
+{
+	return [this, name, delay, threaded, fail](const UpdaterConfig::Package &package, const InstallScheduler::Done &done) {
+		events.append(u"%1:%2"_s.arg(name, package.name));
+		QString error = package.name == fail ? u"%1 failed"_s.arg(name) : QString();
+		if(name == "install"_L1)
+			maxActive = std::max(maxActive, ++active);
+		++running;
+		auto finish = [this, name, error, done] {
+			if(name == "install"_L1)
+				--active;
+			done(error);
+			--running;
+		};
+		if(threaded)
+		{
+			// Verification runs in the thread pool and calls back from there
+			QThreadPool::globalInstance()->start([this, delay, error, done] {
+				QThread::msleep(delay);
+				done(error);
+				--running;
+			});
+		}
+		else if(delay == 0)
+			finish();
+		else
+			QTimer::singleShot(delay, this, finish);
+	};
+}
+
+void InstallSchedulerTest::sort()
+{
+	QList<UpdaterConfig::Package> sorted = InstallScheduler::sort({
+		package(u"c"_s, {u"b"_s}), package(u"a"_s), package(u"b"_s, {u"a"_s, u"installed"_s}), package(u"d"_s)});
+	QStringList names;
+	for(const UpdaterConfig::Package &p: sorted)
+		names.append(p.name);
+	QCOMPARE(names, QStringList({u"a"_s, u"b"_s, u"c"_s, u"d"_s}));
+}
+
+void InstallSchedulerTest::cycle()
+{
+	InstallScheduler scheduler(stage(u"download"_s, 0), stage(u"verify"_s, 0), stage(u"install"_s, 0));
+	QSignalSpy spy(&scheduler, &InstallScheduler::finished);
+	events.clear();
+	QVERIFY(!scheduler.start({package(u"a"_s, {u"b"_s}), package(u"b"_s, {u"a"_s}), package(u"c"_s)}));
+	QVERIFY(events.isEmpty());
+	QVERIFY(spy.isEmpty());
+}
+
+void InstallSchedulerTest::empty()
+{
+	InstallScheduler scheduler(stage(u"download"_s, 0), stage(u"verify"_s, 0), stage(u"install"_s, 0));
+	QSignalSpy spy(&scheduler, &InstallScheduler::finished);
+	QVERIFY(scheduler.start({}));
+	QCOMPARE(spy.size(), 1);
+	QCOMPARE(spy.first().first().toString(), QString());
+}
+
+void InstallSchedulerTest::order()
+{
+	events.clear();
+	InstallScheduler scheduler(stage(u"download"_s, 10), stage(u"verify"_s, 5, true), stage(u"install"_s, 10));
+	QSignalSpy spy(&scheduler, &InstallScheduler::finished);
+	QVERIFY(scheduler.start({package(u"b"_s, {u"a"_s}), package(u"a"_s)}));
+	QVERIFY(spy.wait());
+	QCOMPARE(spy.first().first().toString(), QString());
+	QStringList installs = events.filter(u"install:"_s);
+	QCOMPARE(installs, QStringList({u"install:a"_s, u"install:b"_s}));
+	// Every package goes through all stages in order
+	for(const QString &name: {u"a"_s, u"b"_s})
+	{
+		QVERIFY(events.indexOf(u"download:"_s + name) < events.indexOf(u"verify:"_s + name));
+		QVERIFY(events.indexOf(u"verify:"_s + name) < events.indexOf(u"install:"_s + name));
+	}
+}
+
+void InstallSchedulerTest::pipeline()
+{
+	// Three packages, each stage takes 100 ms. Run time depends on the machine, the pipeline
+	// is checked by the order of stages instead.
+	events.clear();
+	active = maxActive = 0;
+	InstallScheduler scheduler(stage(u"download"_s, 100), stage(u"verify"_s, 100, true), stage(u"install"_s, 100));
+	QSignalSpy spy(&scheduler, &InstallScheduler::finished);
+	QElapsedTimer timer;
+	timer.start();
+	QVERIFY(scheduler.start({package(u"a"_s), package(u"b"_s), package(u"c"_s)}));
+	QVERIFY(spy.wait(10000));
+	qDebug() << "Pipelined run took" << timer.elapsed() << "ms";
+	QCOMPARE(spy.first().first().toString(), QString());
+	// Next download starts before the previous package is installed
+	QVERIFY(events.indexOf(u"download:b"_s) < events.indexOf(u"install:a"_s));
+	QVERIFY(events.indexOf(u"download:c"_s) < events.indexOf(u"install:b"_s));
+	// Installs never overlap
+	QCOMPARE(maxActive, 1);
+	QCOMPARE(events.filter(u"install:"_s).size(), 3);
+}
+
+void InstallSchedulerTest::failure()
+{
+	events.clear();
+	InstallScheduler scheduler(stage(u"download"_s, 10), stage(u"verify"_s, 10, true, u"b"_s), stage(u"install"_s, 50));
+	QSignalSpy spy(&scheduler, &InstallScheduler::finished);
+	QVERIFY(scheduler.start({package(u"a"_s), package(u"b"_s), package(u"c"_s)}));
+	QVERIFY(spy.wait());
+	QCOMPARE(spy.first().first().toString(), u"verify failed"_s);
+	// Let stages that were still running finish, nothing may start after the failure
+	QStringList snapshot = events;
+	QTRY_COMPARE(running.load(), 0);
+	QTest::qWait(0);
+	QCOMPARE(events, snapshot);
+	QCOMPARE(spy.size(), 1);
+	QVERIFY(!events.contains(u"install:b"_s));
+	QVERIFY(!events.contains(u"install:c"_s));
+	QVERIFY(!events.contains(u"verify:c"_s));
+}
+
+void InstallSchedulerTest::synchronous()
+{
+	// Stages calling back immediately must not recurse into the next stage
+	events.clear();
+	InstallScheduler scheduler(stage(u"download"_s, 0), stage(u"verify"_s, 0), stage(u"install"_s, 0));
+	QSignalSpy spy(&scheduler, &InstallScheduler::finished);
+	QList<UpdaterConfig::Package> packages;
+	for(int i = 0; i < 100; ++i)
+		packages.append(package(QString::number(i), i ? QStringList{QString::number(i - 1)} : QStringList()));
+	QVERIFY(scheduler.start(packages));
+	QVERIFY(spy.isEmpty());
+	QVERIFY(spy.wait());
+	QCOMPARE(spy.first().first().toString(), QString());
+	QCOMPARE(events.filter(u"install:"_s).size(), 100);
+	QCOMPARE(events.filter(u"install:"_s).first(), u"install:0"_s);
+	QCOMPARE(events.filter(u"install:"_s).last(), u"install:99"_s);
+}
+
+void InstallSchedulerTest::deleted()
+{
+	// Verification finishing after the scheduler is gone is ignored
+	events.clear();
+	auto *scheduler = new InstallScheduler(stage(u"download"_s, 0), stage(u"verify"_s, 100, true), stage(u"install"_s, 0));
+	QVERIFY(scheduler->start({package(u"a"_s)}));
+	QTRY_VERIFY(events.contains(u"verify:a"_s));
+	delete scheduler;
+	QThreadPool::globalInstance()->waitForDone();
+	QTest::qWait(50);
+	QVERIFY(!events.contains(u"install:a"_s));
+}
+
+QTEST_GUILESS_MAIN(InstallSchedulerTest)
+#include "tst_InstallScheduler.moc"
@@ -0,0 +1,346 @@
+/*
+ * id-updater
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "Downloader.h"
+#include "LocalSource.h"
+#include "RepositoryExport.h"
+#include "TestKey.h"
+#include "TestServer.h"
+
+#include <QDateTime>
+#include <QDir>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QNetworkAccessManager>
+#include <QRandomGenerator>
+#include <QSettings>
+#include <QSignalSpy>
+#include <QTemporaryDir>
+#include <QTest>
+
+using namespace Qt::StringLiterals;
+
+class LocalSourceTest: public QObject
+{
+	Q_OBJECT
+private Q_SLOTS:
+	void initTestCase();
+	void init();
+	void exportAndInstall();
+	void exportNames_data();
+	void exportNames();
+	void exportFailure();
+	void exportOlder();
+	void tampered();
+	void futureDate();
+	void rollback();
+
+private:
+	QByteArray config(int serial, const QDateTime &date, const QJsonArray &extra = {}) const;
+	void publish(int serial, const QDateTime &date, const QJsonArray &extra = {});
+	bool write(const QString &path, int serial, const QDateTime &date) const;
+	QString install(const UpdaterConfig::Package &p, const QString &fileName);
+
+	QTemporaryDir dir;
+	QNetworkAccessManager manager;
+	TestServer server;
+	QByteArray package, plugin;
+};
+
+void LocalSourceTest::initTestCase()
+{
+	QVERIFY(dir.isValid());
+	QVERIFY(server.isListening());
+	QCoreApplication::setOrganizationName(u"RIA"_s);
+	QCoreApplication::setApplicationName(u"id-updater-test"_s);
+	QSettings::setDefaultFormat(QSettings::IniFormat);
+	QSettings::setPath(QSettings::IniFormat, QSettings::UserScope, dir.path());
+	package.resize(1024 * 1024);
+	QRandomGenerator(1).fillRange((quint32*)package.data(), package.size() / sizeof(quint32));
+	plugin = QByteArray("plugin").repeated(10000);
+	server.files.insert(u"/package.msi"_s, package);
+	server.files.insert(u"/package.msi.gz"_s, gzip(package));
+	server.files.insert(u"/plugin.msi"_s, plugin);
+}
+
+void LocalSourceTest::init()
+{
+	QSettings s;
+	s.remove(u"SourceSerial"_s);
+	s.remove(u"SourceDate"_s);
+	s.remove(u"Mirrors"_s);
+	server.stats.clear();
+	server.bytes = 0;
+}
+
+QByteArray LocalSourceTest::config(int serial, const QDateTime &date, const QJsonArray &extra) const
+{
+	QJsonObject component {
+		{u"NAME"_s, u"plugin"_s},
+		{u"LATEST"_s, u"2.0.0"_s},
+		{u"UPGRADECODE"_s, u"{00000000-0000-0000-0000-000000000002}"_s},
+		{u"DOWNLOAD"_s, server.url(u"/plugin.msi"_s).toString()},
+	};
+	QJsonArray components {component};
+	for(const QJsonValue &value: extra)
+		components.append(value);
+	return QJsonDocument(QJsonObject{
+		{u"META-INF"_s, QJsonObject{
+			{u"SERIAL"_s, serial},
+			{u"DATE"_s, date.toUTC().toString(u"yyyyMMddHHmmss'Z'"_s)},
+		}},
+		{u"WIN-LATEST"_s, u"1.0.0"_s},
+		{u"WIN-UPGRADECODE"_s, u"{00000000-0000-0000-0000-000000000001}"_s},
+		{u"WIN-DOWNLOAD"_s, server.url(u"/package.msi"_s).toString()},
+		{u"WIN-MIRRORS"_s, QJsonArray{server.url(u"/package.msi?mirror=2"_s).toString()}},
+		{u"WIN-DOWNLOAD-GZ"_s, server.url(u"/package.msi.gz"_s).toString()},
+		{u"WIN-DOWNLOAD-GZ-SHA256"_s, QString::fromLatin1(
+			QCryptographicHash::hash(server.files.value(u"/package.msi.gz"_s), QCryptographicHash::Sha256).toHex())},
+		{u"WIN-COMPONENTS"_s, components},
+	}).toJson(QJsonDocument::Compact);
+}
+
+void LocalSourceTest::publish(int serial, const QDateTime &date, const QJsonArray &extra)
+{
+	QByteArray json = config(serial, date, extra);
+	server.files.insert(u"/config.json"_s, json);
+	server.files.insert(u"/config.ecc"_s, sign(json).toBase64());
+}
+
+bool LocalSourceTest::write(const QString &path, int serial, const QDateTime &date) const
+{
+	QByteArray json = config(serial, date);
+	QFile file(QDir(path).filePath(u"config.json"_s)), ecc(QDir(path).filePath(u"config.ecc"_s));
+	return QDir().mkpath(path) &&
+		file.open(QFile::WriteOnly) && file.write(json) == json.size() &&
+		ecc.open(QFile::WriteOnly) && ecc.write(sign(json).toBase64()) > 0;
+}
+
+QString LocalSourceTest::install(const UpdaterConfig::Package &p, const QString &fileName)
+{
+	Downloader download(&manager, {}, p);
+	QSignalSpy spy(&download, &Downloader::finished);
+	download.start(dir.filePath(fileName));
+	if(spy.isEmpty() && !spy.wait(10000))
+		return u"timeout"_s;
+	return spy.first().first().toString();
+}
+
+void LocalSourceTest::exportAndInstall()
+{
+	publish(1, QDateTime::currentDateTimeUtc().addDays(-1));
+	QString repo = dir.filePath(u"export"_s);
+	QVERIFY(RepositoryExport::run(&manager, {}, repo, server.url(u"/config.json"_s).toString()));
+	QFile indexFile(QDir(repo).filePath(u"index.json"_s));
+	QVERIFY(indexFile.open(QFile::ReadOnly));
+	QJsonObject index = QJsonDocument::fromJson(indexFile.readAll()).object();
+	QCOMPARE(index.keys(), QStringList({u"package.msi"_s, u"package.msi.gz"_s, u"plugin.msi"_s}));
+	QCOMPARE(index.value("plugin.msi"_L1).toString().toLatin1(),
+		QCryptographicHash::hash(plugin, QCryptographicHash::Sha256).toHex());
+
+	// Clients installing from the repository never contact the servers from the configuration
+	init();
+	LocalSource source(QUrl::fromLocalFile(repo).toString());
+	QCOMPARE(source.load(), QString());
+	UpdaterConfig config;
+	QVERIFY(config.update(source.object()));
+	QCOMPARE(config.components.size(), 1);
+	source.resolve(config.package);
+	source.resolve(config.components.first());
+	QCOMPARE(config.package.mirrors, QList<QUrl>({QUrl::fromLocalFile(source.filePath(u"package.msi"_s))}));
+	QCOMPARE(config.package.compressed, QList<QUrl>({QUrl::fromLocalFile(source.filePath(u"package.msi.gz"_s))}));
+	QCOMPARE(config.package.checksum, QCryptographicHash::hash(package, QCryptographicHash::Sha256));
+
+	QCOMPARE(install(config.package, u"package.msi"_s), QString());
+	QFile installed(dir.filePath(u"package.msi"_s));
+	QVERIFY(installed.open(QFile::ReadOnly));
+	QCOMPARE(installed.readAll(), package);
+	QCOMPARE(install(config.components.first(), u"plugin.msi"_s), QString());
+	QCOMPARE(server.bytes, qint64(0));
+	QVERIFY(server.stats.isEmpty());
+}
+
+void LocalSourceTest::exportNames_data()
+{
+	QTest::addColumn<QString>("path");
+	QTest::addColumn<bool>("valid");
+	QTest::newRow("same file") << u"/plugin.msi"_s << true;
+	QTest::newRow("same name") << u"/other/plugin.msi"_s << false;
+	QTest::newRow("same name other case") << u"/other/Plugin.msi"_s << false;
+	QTest::newRow("config.json") << u"/other/config.json"_s << false;
+	QTest::newRow("config.ecc") << u"/other/CONFIG.ECC"_s << false;
+	QTest::newRow("index.json") << u"/other/index.json"_s << false;
+}
+
+void LocalSourceTest::exportNames()
+{
+	QFETCH(QString, path);
+	QFETCH(bool, valid);
+	QJsonObject component {
+		{u"NAME"_s, u"other"_s},
+		{u"LATEST"_s, u"2.0.0"_s},
+		{u"UPGRADECODE"_s, u"{00000000-0000-0000-0000-000000000003}"_s},
+		{u"DOWNLOAD"_s, server.url(path).toString()},
+	};
+	publish(1, QDateTime::currentDateTimeUtc().addDays(-1), {component});
+	QString repo = dir.filePath(u"names/"_s + QTest::currentDataTag());
+	// Rejected names fail before the file is requested
+	QCOMPARE(RepositoryExport::run(&manager, {}, repo, server.url(u"/config.json"_s).toString()), valid);
+}
+
+void LocalSourceTest::exportFailure()
+{
+	QString repo = dir.filePath(u"failure"_s);
+	publish(1, QDateTime::currentDateTimeUtc().addDays(-2));
+	QVERIFY(RepositoryExport::run(&manager, {}, repo, server.url(u"/config.json"_s).toString()));
+
+	// Package missing on the server, previous export stays usable and no staging directory is left
+	QJsonObject component {
+		{u"NAME"_s, u"missing"_s},
+		{u"LATEST"_s, u"2.0.0"_s},
+		{u"UPGRADECODE"_s, u"{00000000-0000-0000-0000-000000000003}"_s},
+		{u"DOWNLOAD"_s, server.url(u"/missing.msi"_s).toString()},
+	};
+	publish(2, QDateTime::currentDateTimeUtc().addDays(-1), {component});
+	QVERIFY(!RepositoryExport::run(&manager, {}, repo, server.url(u"/config.json"_s).toString()));
+	QCOMPARE(QDir(dir.path()).entryList({u"failure*"_s}, QDir::AllEntries | QDir::NoDotAndDotDot), QStringList{u"failure"_s});
+	LocalSource source(repo);
+	QCOMPARE(source.load(), QString());
+	QCOMPARE(source.object().value("META-INF"_L1).toObject().value("SERIAL"_L1).toInt(), 1);
+	QVERIFY(QFile::exists(source.filePath(u"plugin.msi"_s)));
+	QVERIFY(!QFile::exists(source.filePath(u"missing.msi"_s)));
+
+	// Successful export replaces the previous one
+	publish(2, QDateTime::currentDateTimeUtc().addDays(-1));
+	QVERIFY(RepositoryExport::run(&manager, {}, repo, server.url(u"/config.json"_s).toString()));
+	QCOMPARE(QDir(dir.path()).entryList({u"failure*"_s}, QDir::AllEntries | QDir::NoDotAndDotDot), QStringList{u"failure"_s});
+	QCOMPARE(source.load(), QString());
+	QCOMPARE(source.object().value("META-INF"_L1).toObject().value("SERIAL"_L1).toInt(), 2);
+}
+
+void LocalSourceTest::exportOlder()
+{
+	// Export keeps no rollback state, production configuration can be exported after a later staging one
+	QString repo = dir.filePath(u"older"_s);
+	QDateTime now = QDateTime::currentDateTimeUtc();
+	publish(5, now.addSecs(-3600));
+	QVERIFY(RepositoryExport::run(&manager, {}, dir.filePath(u"staging"_s), server.url(u"/config.json"_s).toString()));
+	QVERIFY(RepositoryExport::run(&manager, {}, repo, server.url(u"/config.json"_s).toString()));
+	publish(3, now.addSecs(-7200));
+	QVERIFY(RepositoryExport::run(&manager, {}, repo, server.url(u"/config.json"_s).toString()));
+	QVERIFY(!QSettings().contains(u"SourceSerial"_s));
+	QVERIFY(!QSettings().contains(u"SourceDate"_s));
+	LocalSource source(repo);
+	QCOMPARE(source.load(), QString());
+	QCOMPARE(source.object().value("META-INF"_L1).toObject().value("SERIAL"_L1).toInt(), 3);
+}
+
+void LocalSourceTest::tampered()
+{
+	publish(1, QDateTime::currentDateTimeUtc().addDays(-1));
+	QString repo = dir.filePath(u"tampered"_s);
+	QVERIFY(RepositoryExport::run(&manager, {}, repo, server.url(u"/config.json"_s).toString()));
+	QDir d(repo);
+
+	// Package replaced after export
+	init();
+	{
+		QFile file(d.filePath(u"plugin.msi"_s));
+		QVERIFY(file.open(QFile::WriteOnly));
+		file.write(QByteArray("tampered").repeated(10000));
+	}
+	LocalSource source(repo);
+	QCOMPARE(source.load(), QString());
+	UpdaterConfig config;
+	QVERIFY(config.update(source.object()));
+	source.resolve(config.components.first());
+	QCOMPARE(install(config.components.first(), u"plugin.msi"_s), u"Downloaded file checksum does not match"_s);
+
+	// Configuration changed after signing
+	{
+		QFile file(d.filePath(u"config.json"_s));
+		QVERIFY(file.open(QFile::Append));
+		file.write(" ");
+	}
+	QCOMPARE(LocalSource(repo).load(), u"The configuration file located on the server cannot be validated."_s);
+
+	// Signature missing
+	QVERIFY(d.remove(u"config.ecc"_s));
+	QCOMPARE(LocalSource(repo).load(), u"Failed to open update repository %1"_s.arg(repo));
+}
+
+void LocalSourceTest::futureDate()
+{
+	QString repo = dir.filePath(u"future"_s);
+	QVERIFY(write(repo, 1, QDateTime::currentDateTimeUtc().addDays(1)));
+	QCOMPARE(LocalSource(repo).load(), u"The configuration file located on the server cannot be validated."_s);
+	QVERIFY(!QSettings().contains(u"SourceSerial"_s));
+}
+
+void LocalSourceTest::rollback()
+{
+	QString repo = dir.filePath(u"rollback"_s);
+	QDateTime now = QDateTime::currentDateTimeUtc();
+	const QString error = u"Your computer's configuration file is later than the server has."_s;
+	auto serial = [](const LocalSource &source) {
+		return source.object().value("META-INF"_L1).toObject().value("SERIAL"_L1).toInt();
+	};
+
+	// Accepted repository is remembered, older one keeps the previous configuration
+	LocalSource source(repo);
+	QVERIFY(write(repo, 5, now.addSecs(-3600)));
+	QCOMPARE(source.load(), QString());
+	QCOMPARE(QSettings().value(u"SourceSerial"_s).toInt(), 5);
+	QVERIFY(write(repo, 4, now.addSecs(-7200)));
+	QCOMPARE(source.load(), error);
+	QCOMPARE(serial(source), 5);
+
+	// Same serial with older date
+	QVERIFY(write(repo, 5, now.addSecs(-10800)));
+	QCOMPARE(source.load(), error);
+
+	// Reloading the same or newer configuration is allowed
+	QVERIFY(write(repo, 5, now.addSecs(-3600)));
+	QCOMPARE(source.load(), QString());
+	QVERIFY(write(repo, 6, now.addSecs(-60)));
+	QCOMPARE(source.load(), QString());
+	QCOMPARE(serial(source), 6);
+
+	// Built-in or cached configuration is newer than the repository
+	init();
+	QJsonObject trusted {{u"META-INF"_s, QJsonObject{
+		{u"SERIAL"_s, 10},
+		{u"DATE"_s, now.addSecs(-120).toString(u"yyyyMMddHHmmss'Z'"_s)},
+	}}};
+	QCOMPARE(LocalSource(repo).load(trusted), error);
+	trusted[u"META-INF"_s] = QJsonObject{
+		{u"SERIAL"_s, 1},
+		{u"DATE"_s, now.addSecs(-30).toString(u"yyyyMMddHHmmss'Z'"_s)},
+	};
+	QCOMPARE(LocalSource(repo).load(trusted), error);
+	QVERIFY(!QSettings().contains(u"SourceSerial"_s));
+	trusted[u"META-INF"_s] = QJsonObject{
+		{u"SERIAL"_s, 6},
+		{u"DATE"_s, now.addSecs(-60).toString(u"yyyyMMddHHmmss'Z'"_s)},
+	};
+	QCOMPARE(LocalSource(repo).load(trusted), QString());
+}
+
+QTEST_GUILESS_MAIN(LocalSourceTest)
+#include "tst_LocalSource.moc"
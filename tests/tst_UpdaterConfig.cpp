@@ -0,0 +1,334 @@
+/*
+ * id-updater
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "UpdaterConfig.h"
+
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRandomGenerator>
+#include <QTest>
+
+using namespace Qt::StringLiterals;
+
+static const auto CERT = u"MIIBijCCATGgAwIBAgIULy7znr7RQrjLuIdXmaccWW4gA+YwCgYIKoZIzj0EAwIwGjEYMBYGA1UEAwwPaWQtdXBkYXRlciB0ZXN0"
+	"MCAXDTI2MTAxOTEyNTYzNVoYDzIxMjYwOTI1MTI1NjM1WjAaMRgwFgYDVQQDDA9pZC11cGRhdGVyIHRlc3QwWTATBgcqhkjOPQIBBggqhkjOPQMB"
+	"BwNCAAQXW81vf9DmD3shR8eDpjjfxeh0xjmO5xuE2ff/Cm9viR10u2yOTGI2UOFLqryh/AqSDBoMrJug+Hy0Ul0O/uyBo1MwUTAdBgNVHQ4EFgQU"
+	"gC8lE0HwZp/sR7GcceY/DBegyUEwHwYDVR0jBBgwFoAUgC8lE0HwZp/sR7GcceY/DBegyUEwDwYDVR0TAQH/BAUwAwEB/zAKBggqhkjOPQQDAgNH"
+	"ADBEAiAtmSpmO+3KOikSbeXxl0rkPnMJeX9C6hceKNx1KDUHeQIgTXeFc/woXxalqXSpYUyhPmntcF+qpJbw9QARyjU9FLg="_s;
+
+class UpdaterConfigTest: public QObject
+{
+	Q_OBJECT
+private Q_SLOTS:
+	void parse();
+	void typeErrors_data();
+	void typeErrors();
+	void certificates();
+	void fuzzValues();
+	void fuzzDocument();
+	void benchmark_data();
+	void benchmark();
+
+private:
+	static QJsonObject sample(int components = 3, int certificates = 1, int serial = 1);
+	static QString snapshot(const UpdaterConfig &config);
+	static QJsonValue randomValue(QRandomGenerator &random, int depth = 0);
+};
+
+QJsonObject UpdaterConfigTest::sample(int components, int certificates, int serial)
+{
+	QJsonArray list;
+	for(int i = 0; i < components; ++i)
+	{
+		QJsonArray depends;
+		if(i > 0)
+			depends.append(u"component-%1"_s.arg(i - 1));
+		list.append(QJsonObject{
+			{u"NAME"_s, u"component-%1"_s.arg(i)},
+			{u"LATEST"_s, u"1.0.%1"_s.arg(i)},
+			{u"UPGRADECODE"_s, u"{00000000-0000-0000-0000-%1}"_s.arg(i, 12, 10, '0'_L1)},
+			{u"DOWNLOAD"_s, u"https://example.com/component-%1.msi"_s.arg(i)},
+			{u"MIRRORS"_s, QJsonArray{u"https://mirror.example.com/component-%1.msi"_s.arg(i)}},
+			{u"DEPENDS"_s, depends},
+		});
+	}
+	QJsonArray bundle;
+	for(int i = 0; i < certificates; ++i)
+		bundle.append(CERT);
+	return {
+		{u"META-INF"_s, QJsonObject{{u"SERIAL"_s, serial}, {u"DATE"_s, u"20261019120000Z"_s}}},
+		{u"CERT-BUNDLE"_s, bundle},
+		{u"WIN-MESSAGE"_s, u"message"_s},
+		{u"UPDATER-MESSAGE-URL"_s, u"https://example.com/message.json"_s},
+		{u"WIN-LATEST"_s, u"3.19.0.100"_s},
+		{u"WIN-UPGRADECODE"_s, u"{58A1DBA8-81A2-4D58-980B-4A6174D5B66B}"_s},
+		{u"WIN-DOWNLOAD"_s, u"https://example.com/Open-EID.exe"_s},
+		{u"WIN-MIRRORS"_s, QJsonArray{u"https://mirror.example.com/Open-EID.exe"_s}},
+		{u"WIN-DOWNLOAD-GZ"_s, u"https://example.com/Open-EID.exe.gz"_s},
+		{u"WIN-DOWNLOAD-GZ-SHA256"_s, u"00112233445566778899aabbccddeeff00112233445566778899aabbccddeeff"_s},
+		{u"WIN-COMPONENTS"_s, list},
+	};
+}
+
+QString UpdaterConfigTest::snapshot(const UpdaterConfig &config)
+{
+	auto package = [](const UpdaterConfig::Package &p) {
+		QStringList urls;
+		for(const QUrl &url: p.mirrors + p.compressed)
+			urls.append(url.toString());
+		return QStringList{p.name, p.latest, p.upgradeCode, p.depends.join(','), urls.join(','),
+			QString::fromLatin1(p.compressedHash.toHex())}.join(';');
+	};
+	QStringList result{QString::number(config.serial), config.message, config.messageUrl.toString(),
+		package(config.package), QString::number(config.certificates().size())};
+	for(const UpdaterConfig::Package &c: config.components)
+		result.append(package(c));
+	return result.join('\n');
+}
+
+QJsonValue UpdaterConfigTest::randomValue(QRandomGenerator &random, int depth)
+{
+	switch(random.bounded(depth < 2 ? 7 : 5))
+	{
+	case 0: return QJsonValue::Null;
+	case 1: return random.bounded(2) == 1;
+	case 2: return random.bounded(-1000, 1000);
+	case 3: return QString();
+	case 4: return u"https://example.com/%1"_s.arg(random.generate());
+	case 5: return QJsonArray{randomValue(random, depth + 1), randomValue(random, depth + 1)};
+	default: return QJsonObject{{u"SERIAL"_s, randomValue(random, depth + 1)}};
+	}
+}
+
+void UpdaterConfigTest::parse()
+{
+	UpdaterConfig config;
+	QVERIFY(config.update(sample()));
+	QCOMPARE(config.serial, 1);
+	QCOMPARE(config.message, u"message"_s);
+	QCOMPARE(config.messageUrl, QUrl(u"https://example.com/message.json"_s));
+	QCOMPARE(config.package.latest, u"3.19.0.100"_s);
+	QCOMPARE(config.package.fileName(), u"Open-EID.exe"_s);
+	QCOMPARE(config.package.mirrors.size(), 2);
+	QCOMPARE(config.package.compressed, QList<QUrl>{QUrl(u"https://example.com/Open-EID.exe.gz"_s)});
+	QCOMPARE(config.package.compressedHash.size(), 32);
+	QCOMPARE(config.components.size(), 3);
+	QCOMPARE(config.components.at(2).name, u"component-2"_s);
+	QCOMPARE(config.components.at(2).depends, QStringList{u"component-1"_s});
+	QCOMPARE(config.certificates().size(), 1);
+	QVERIFY(!config.certificates().first().isNull());
+
+	// Compressed variant without checksum is ignored
+	QJsonObject obj = sample();
+	obj.remove(u"WIN-DOWNLOAD-GZ-SHA256"_s);
+	QVERIFY(config.update(obj));
+	QVERIFY(config.package.compressed.isEmpty());
+}
+
+void UpdaterConfigTest::typeErrors_data()
+{
+	QTest::addColumn<QString>("path");
+	QTest::addColumn<QJsonValue>("value");
+
+	QTest::newRow("META-INF") << u"META-INF"_s << QJsonValue(u"x"_s);
+	QTest::newRow("CERT-BUNDLE") << u"CERT-BUNDLE"_s << QJsonValue(u"x"_s);
+	QTest::newRow("CERT-BUNDLE entry") << u"CERT-BUNDLE"_s << QJsonValue(QJsonArray{CERT, 1});
+	QTest::newRow("WIN-MESSAGE") << u"WIN-MESSAGE"_s << QJsonValue(1);
+	QTest::newRow("UPDATER-MESSAGE-URL") << u"UPDATER-MESSAGE-URL"_s << QJsonValue(QJsonArray());
+	QTest::newRow("WIN-LATEST") << u"WIN-LATEST"_s << QJsonValue(3.19);
+	QTest::newRow("WIN-DOWNLOAD") << u"WIN-DOWNLOAD"_s << QJsonValue(QJsonObject());
+	QTest::newRow("WIN-MIRRORS") << u"WIN-MIRRORS"_s << QJsonValue(u"https://example.com"_s);
+	QTest::newRow("WIN-MIRRORS entry") << u"WIN-MIRRORS"_s << QJsonValue(QJsonArray{true});
+	QTest::newRow("WIN-DOWNLOAD-GZ-SHA256") << u"WIN-DOWNLOAD-GZ-SHA256"_s << QJsonValue(QJsonValue::Null);
+	QTest::newRow("WIN-MIRRORS-GZ entry") << u"WIN-MIRRORS-GZ"_s << QJsonValue(QJsonArray{QJsonValue(QJsonArray())});
+	QTest::newRow("WIN-COMPONENTS") << u"WIN-COMPONENTS"_s << QJsonValue(QJsonObject());
+	QTest::newRow("WIN-COMPONENTS entry") << u"WIN-COMPONENTS"_s << QJsonValue(QJsonArray{u"component"_s});
+	QTest::newRow("NAME") << u"0/NAME"_s << QJsonValue(QJsonValue::Undefined);
+	QTest::newRow("NAME type") << u"0/NAME"_s << QJsonValue(1);
+	QTest::newRow("UPGRADECODE") << u"0/UPGRADECODE"_s << QJsonValue(QJsonValue::Undefined);
+	QTest::newRow("UPGRADECODE empty") << u"1/UPGRADECODE"_s << QJsonValue(u""_s);
+	QTest::newRow("DEPENDS") << u"1/DEPENDS"_s << QJsonValue(u"component-0"_s);
+	QTest::newRow("DEPENDS entry") << u"1/DEPENDS"_s << QJsonValue(QJsonArray{0});
+	QTest::newRow("DEPENDS null entry") << u"1/DEPENDS"_s << QJsonValue(QJsonArray{QJsonValue::Null});
+	QTest::newRow("MIRRORS entry") << u"2/MIRRORS"_s << QJsonValue(QJsonArray{QJsonObject()});
+}
+
+void UpdaterConfigTest::typeErrors()
+{
+	QFETCH(QString, path);
+	QFETCH(QJsonValue, value);
+
+	UpdaterConfig config;
+	QVERIFY(config.update(sample(3, 1, 1)));
+	QString before = snapshot(config);
+
+	QJsonObject obj = sample(3, 1, 2);
+	if(qsizetype pos = path.indexOf('/'); pos > 0)
+	{
+		QJsonArray components = obj.value(u"WIN-COMPONENTS"_s).toArray();
+		int index = path.left(pos).toInt();
+		QJsonObject component = components.at(index).toObject();
+		if(value.isUndefined())
+			component.remove(path.mid(pos + 1));
+		else
+			component.insert(path.mid(pos + 1), value);
+		components.replace(index, component);
+		obj.insert(u"WIN-COMPONENTS"_s, components);
+	}
+	else
+		obj.insert(path, value);
+
+	QVERIFY(!config.update(obj));
+	QCOMPARE(snapshot(config), before);
+}
+
+void UpdaterConfigTest::certificates()
+{
+	UpdaterConfig config;
+	QVERIFY(config.update(sample(1, 2, 5)));
+	QCOMPARE(config.certificates().size(), 2);
+	// Same SERIAL keeps the decoded bundle even when the document differs
+	QVERIFY(config.update(sample(1, 3, 5)));
+	QCOMPARE(config.certificates().size(), 2);
+	QVERIFY(config.update(sample(1, 3, 6)));
+	QCOMPARE(config.certificates().size(), 3);
+	// Documents without SERIAL are always decoded again
+	QJsonObject obj = sample(1, 1);
+	obj.remove(u"META-INF"_s);
+	QVERIFY(config.update(obj));
+	QCOMPARE(config.serial, -1);
+	QCOMPARE(config.certificates().size(), 1);
+	obj.insert(u"CERT-BUNDLE"_s, QJsonArray{CERT, u"not base64 !"_s});
+	QVERIFY(config.update(obj));
+	QCOMPARE(config.certificates().size(), 2);
+	QVERIFY(config.certificates().at(1).isNull());
+}
+
+void UpdaterConfigTest::fuzzValues()
+{
+	// Replace or remove random keys, failed updates must leave previous state untouched
+	QRandomGenerator random(20261019);
+	const QJsonObject base = sample(4, 1, 1);
+	const QStringList keys = base.keys();
+	const QStringList componentKeys = base.value(u"WIN-COMPONENTS"_s).toArray().first().toObject().keys();
+	int accepted = 0;
+	for(int round = 0; round < 5000; ++round)
+	{
+		UpdaterConfig config;
+		QVERIFY(config.update(base));
+		QString before = snapshot(config);
+		QJsonObject obj = base;
+		for(int i = 0, count = random.bounded(1, 4); i < count; ++i)
+		{
+			if(random.bounded(2) == 0)
+			{
+				const QString &key = keys.at(random.bounded(keys.size()));
+				if(random.bounded(4) == 0)
+					obj.remove(key);
+				else
+					obj.insert(key, randomValue(random));
+				continue;
+			}
+			QJsonArray components = obj.value(u"WIN-COMPONENTS"_s).toArray();
+			if(components.isEmpty())
+				continue;
+			int index = random.bounded(int(components.size()));
+			QJsonObject component = components.at(index).toObject();
+			const QString &key = componentKeys.at(random.bounded(componentKeys.size()));
+			if(random.bounded(4) == 0)
+				component.remove(key);
+			else
+				component.insert(key, randomValue(random));
+			components.replace(index, component);
+			obj.insert(u"WIN-COMPONENTS"_s, components);
+		}
+		if(config.update(obj))
+		{
+			++accepted;
+			UpdaterConfig fresh;
+			QVERIFY(fresh.update(obj));
+			QCOMPARE(snapshot(config).section('\n', 0, 3), snapshot(fresh).section('\n', 0, 3));
+		}
+		else
+			QCOMPARE(snapshot(config), before);
+
+		UpdaterConfig::Package package;
+		UpdaterConfig::Package::parse(obj, u"WIN-"_s, package);
+		UpdaterConfig::Package::parse(QJsonObject{{u"DOWNLOAD"_s, randomValue(random)},
+			{u"MIRRORS"_s, randomValue(random)}, {u"DOWNLOAD-GZ"_s, randomValue(random)},
+			{u"DOWNLOAD-GZ-SHA256"_s, randomValue(random)}, {u"MIRRORS-GZ"_s, randomValue(random)}}, {}, package);
+	}
+	qDebug() << "Accepted" << accepted << "of 5000 mutated documents";
+	QVERIFY(accepted > 0);
+}
+
+void UpdaterConfigTest::fuzzDocument()
+{
+	// Byte level mutations of the serialized document
+	QRandomGenerator random(42);
+	const QByteArray base = QJsonDocument(sample(4, 1, 1)).toJson(QJsonDocument::Compact);
+	for(int round = 0; round < 5000; ++round)
+	{
+		QByteArray data = base;
+		for(int i = 0, count = random.bounded(1, 8); i < count; ++i)
+		{
+			qsizetype pos = random.bounded(int(data.size()));
+			switch(random.bounded(3))
+			{
+			case 0: data[pos] = char(random.bounded(256)); break;
+			case 1: data.remove(pos, random.bounded(1, 16)); break;
+			default: data.insert(pos, "[]{}\",:0"[random.bounded(8)]); break;
+			}
+		}
+		QJsonDocument doc = QJsonDocument::fromJson(data);
+		UpdaterConfig config;
+		if(config.update(doc.object()))
+			snapshot(config);
+	}
+}
+
+void UpdaterConfigTest::benchmark_data()
+{
+	QTest::addColumn<int>("components");
+	QTest::addColumn<int>("certificates");
+
+	QTest::newRow("production size") << 10 << 20;
+	QTest::newRow("1000 components") << 1000 << 100;
+	QTest::newRow("10000 components") << 10000 << 500;
+}
+
+void UpdaterConfigTest::benchmark()
+{
+	QFETCH(int, components);
+	QFETCH(int, certificates);
+
+	const QByteArray data = QJsonDocument(sample(components, certificates)).toJson();
+	qDebug() << "Config size" << data.size() / 1024 << "KiB";
+	UpdaterConfig config;
+	QBENCHMARK {
+		// Parsing the document and the config, certificates are decoded on first use
+		QVERIFY(config.update(QJsonDocument::fromJson(data).object()));
+		QCOMPARE(config.components.size(), components);
+	}
+	QCOMPARE(config.certificates().size(), certificates);
+}
+
+QTEST_GUILESS_MAIN(UpdaterConfigTest)
+#include "tst_UpdaterConfig.moc"
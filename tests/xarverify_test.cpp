@@ -0,0 +1,288 @@
+/*
+ * id-updater
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "xarverify.h"
+
+#include <openssl/cms.h>
+#include <openssl/evp.h>
+#include <openssl/rsa.h>
+#include <openssl/x509.h>
+#include <zlib.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <initializer_list>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+using Bytes = std::vector<unsigned char>;
+
+template<class T, class D>
+static std::unique_ptr<T, D> make_unique_ptr(T *p, D d) noexcept
+{
+	return {p, d};
+}
+
+static int failures = 0;
+
+#define CHECK_STATUS(expr, expected) check(#expr, (expr), (expected), __LINE__)
+
+static void check(const char *expr, XarVerifyStatus status, XarVerifyStatus expected, int line)
+{
+	if(status == expected)
+		return;
+	std::fprintf(stderr, "FAIL line %d: %s returned %d, expected %d\n", line, expr, status, expected);
+	++failures;
+}
+
+struct Signer
+{
+	std::unique_ptr<EVP_PKEY, decltype(&EVP_PKEY_free)> key {EVP_RSA_gen(2048), EVP_PKEY_free};
+	std::unique_ptr<X509, decltype(&X509_free)> cert {X509_new(), X509_free};
+	Bytes der;
+
+	Signer()
+	{
+		X509_set_version(cert.get(), 2);
+		ASN1_INTEGER_set(X509_get_serialNumber(cert.get()), 1);
+		X509_gmtime_adj(X509_getm_notBefore(cert.get()), 0);
+		X509_gmtime_adj(X509_getm_notAfter(cert.get()), 3600);
+		X509_set_pubkey(cert.get(), key.get());
+		X509_NAME *name = X509_get_subject_name(cert.get());
+		X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char*)"xarverify test", -1, -1, 0);
+		X509_set_issuer_name(cert.get(), name);
+		X509_sign(cert.get(), key.get(), EVP_sha256());
+		der.resize(size_t(i2d_X509(cert.get(), nullptr)));
+		unsigned char *p = der.data();
+		i2d_X509(cert.get(), &p);
+	}
+
+	Bytes rsa(const Bytes &digest, const EVP_MD *md) const
+	{
+		auto ctx = make_unique_ptr(EVP_PKEY_CTX_new(key.get(), nullptr), EVP_PKEY_CTX_free);
+		size_t size = 0;
+		EVP_PKEY_sign_init(ctx.get());
+		EVP_PKEY_CTX_set_rsa_padding(ctx.get(), RSA_PKCS1_PADDING);
+		EVP_PKEY_CTX_set_signature_md(ctx.get(), md);
+		EVP_PKEY_sign(ctx.get(), nullptr, &size, digest.data(), digest.size());
+		Bytes result(size);
+		EVP_PKEY_sign(ctx.get(), result.data(), &size, digest.data(), digest.size());
+		result.resize(size);
+		return result;
+	}
+
+	Bytes cms(const Bytes &digest) const
+	{
+		auto data = make_unique_ptr(BIO_new_mem_buf(digest.data(), int(digest.size())), BIO_free);
+		auto cms = make_unique_ptr(CMS_sign(cert.get(), key.get(), nullptr, data.get(), CMS_BINARY | CMS_DETACHED), CMS_ContentInfo_free);
+		Bytes result(size_t(i2d_CMS_ContentInfo(cms.get(), nullptr)));
+		unsigned char *p = result.data();
+		i2d_CMS_ContentInfo(cms.get(), &p);
+		return result;
+	}
+};
+
+static Bytes digest(const EVP_MD *md, const Bytes &data)
+{
+	Bytes result(EVP_MAX_MD_SIZE);
+	unsigned int len = 0;
+	EVP_Digest(data.data(), data.size(), result.data(), &len, md, nullptr);
+	result.resize(len);
+	return result;
+}
+
+static std::string hex(const Bytes &data)
+{
+	static constexpr char digits[] = "0123456789abcdef";
+	std::string result;
+	for(unsigned char c: data)
+		result += {digits[c >> 4], digits[c & 0x0F]};
+	return result;
+}
+
+static std::string base64(const Bytes &data)
+{
+	std::string result(4 * ((data.size() + 2) / 3), 0);
+	EVP_EncodeBlock((unsigned char*)result.data(), data.data(), int(data.size()));
+	return result;
+}
+
+static Bytes compress(const std::string &data)
+{
+	uLongf size = compressBound(uLong(data.size()));
+	Bytes result(size);
+	::compress(result.data(), &size, (const Bytef*)data.data(), uLong(data.size()));
+	result.resize(size);
+	return result;
+}
+
+static void append(Bytes &out, uint64_t value, int bytes)
+{
+	for(int i = bytes - 1; i >= 0; --i)
+		out.push_back((unsigned char)(value >> (i * 8)));
+}
+
+enum class Signature { RSA, CMS };
+
+/**
+ * Builds xar archive in the layout pkgbuild produces: heap starts with TOC checksum,
+ * followed by RSA signature, optional CMS signature and archived file data.
+ */
+static Bytes makeXar(const Signer &signer, Signature type, const char *style, const Bytes &payload)
+{
+	const EVP_MD *md = EVP_get_digestbyname(style);
+	size_t checksumSize = size_t(EVP_MD_get_size(md));
+	std::string cert = base64(signer.der);
+	std::string keyInfo = "<KeyInfo xmlns=\"http://www.w3.org/2000/09/xmldsig#\"><X509Data><X509Certificate>" +
+		cert + "</X509Certificate></X509Data></KeyInfo>";
+	size_t cmsSize = 0;
+	for(int round = 0; round < 4; ++round)
+	{
+		size_t rsaOffset = checksumSize, cmsOffset = rsaOffset + 256;
+		size_t fileOffset = cmsOffset + (type == Signature::CMS ? cmsSize : 0);
+		std::string toc = std::string("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<xar><toc>") +
+			"<checksum style=\"" + style + "\"><offset>0</offset><size>" + std::to_string(checksumSize) + "</size></checksum>" +
+			"<signature style=\"RSA\"><offset>" + std::to_string(rsaOffset) + "</offset><size>256</size>" + keyInfo + "</signature>";
+		if(type == Signature::CMS)
+			toc += "<x-signature style=\"CMS\"><offset>" + std::to_string(cmsOffset) + "</offset><size>" +
+				std::to_string(cmsSize) + "</size>" + keyInfo + "</x-signature>";
+		toc += "<file id=\"1\"><name>Contents</name><type>directory</type><file id=\"2\"><name>Payload</name><data><length>" +
+			std::to_string(payload.size()) + "</length><offset>" + std::to_string(fileOffset) + "</offset><size>" +
+			std::to_string(payload.size()) + "</size><encoding style=\"application/octet-stream\"/>"
+			"<archived-checksum style=\"sha1\">" + hex(digest(EVP_sha1(), payload)) + "</archived-checksum></data></file></file>"
+			"</toc></xar>";
+		Bytes compressed = compress(toc);
+		Bytes checksum = digest(md, compressed);
+		Bytes rsa = signer.rsa(checksum, md);
+		Bytes cms = type == Signature::CMS ? signer.cms(checksum) : Bytes();
+		if(type == Signature::CMS && cms.size() != cmsSize)
+		{
+			// Signature size is part of the TOC, repeat until it is stable
+			cmsSize = cms.size();
+			continue;
+		}
+		Bytes out {'x', 'a', 'r', '!'};
+		append(out, 28, 2);
+		append(out, 1, 2);
+		append(out, compressed.size(), 8);
+		append(out, toc.size(), 8);
+		append(out, 1, 4);
+		for(const Bytes *part: std::initializer_list<const Bytes*>{&compressed, &checksum, &rsa, &cms, &payload})
+			out.insert(out.end(), part->cbegin(), part->cend());
+		return out;
+	}
+	return {};
+}
+
+static std::string write(const std::string &dir, const std::string &name, const Bytes &data)
+{
+	std::string path = dir + "/" + name;
+	std::ofstream(path, std::ios::binary).write((const char*)data.data(), std::streamsize(data.size()));
+	return path;
+}
+
+static XarVerifyStatus verify(const std::string &path, const Signer &signer)
+{
+	const uint8_t *certs[] = {signer.der.data()};
+	size_t sizes[] = {signer.der.size()};
+	return xar_verify_package(path.c_str(), certs, sizes, 1);
+}
+
+template<class F>
+static double measure(F &&f, int rounds = 5)
+{
+	auto begin = std::chrono::steady_clock::now();
+	for(int i = 0; i < rounds; ++i)
+		f();
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count() / rounds;
+}
+
+int main()
+{
+	char tmpl[] = "/tmp/xarverify.XXXXXX";
+	std::string dir = mkdtemp(tmpl);
+	Signer signer, other;
+	std::mt19937 random(42);
+	Bytes payload(256 * 1024);
+	for(unsigned char &c: payload)
+		c = (unsigned char)random();
+
+	for(const char *style: {"sha1", "sha256", "sha512"})
+	{
+		for(Signature type: {Signature::RSA, Signature::CMS})
+		{
+			Bytes xar = makeXar(signer, type, style, payload);
+			std::string name = std::string(style) + (type == Signature::RSA ? "-rsa" : "-cms");
+			CHECK_STATUS(verify(write(dir, name + ".pkg", xar), signer), XarVerifyOK);
+			CHECK_STATUS(verify(dir + "/" + name + ".pkg", other), XarVerifyNoMatchingCertificate);
+
+			Bytes heap = xar;
+			heap[heap.size() - 10] ^= 0xFF;
+			CHECK_STATUS(verify(write(dir, name + "-heap.pkg", heap), signer), XarVerifyChecksumMismatch);
+
+			Bytes toc = xar;
+			toc[40] ^= 0xFF;
+			XarVerifyStatus status = verify(write(dir, name + "-toc.pkg", toc), signer);
+			if(status != XarVerifyChecksumMismatch && status != XarVerifyInvalidArchive)
+				CHECK_STATUS(status, XarVerifyChecksumMismatch);
+
+			Bytes signature = xar;
+			size_t tocSize = (size_t(xar[12]) << 24) | (size_t(xar[13]) << 16) | (size_t(xar[14]) << 8) | xar[15];
+			size_t checksumSize = size_t(EVP_MD_get_size(EVP_get_digestbyname(style)));
+			signature[28 + tocSize + checksumSize + (type == Signature::CMS ? 256 + 100 : 10)] ^= 0xFF;
+			status = verify(write(dir, name + "-sig.pkg", signature), signer);
+			if(status != XarVerifySignatureFailed)
+				CHECK_STATUS(status, XarVerifySignatureFailed);
+
+			Bytes truncated(xar.cbegin(), xar.cbegin() + 64);
+			CHECK_STATUS(verify(write(dir, name + "-short.pkg", truncated), signer), XarVerifyInvalidArchive);
+		}
+	}
+	CHECK_STATUS(verify(dir + "/missing.pkg", signer), XarVerifyOpenFailed);
+	CHECK_STATUS(verify(write(dir, "empty.pkg", {}), signer), XarVerifyOpenFailed);
+	CHECK_STATUS(verify(write(dir, "garbage.pkg", Bytes(payload.cbegin(), payload.cbegin() + 1024)), signer), XarVerifyInvalidArchive);
+
+	// Single mapped pass compared to the previous flow, which checksummed the whole image
+	// (hdiutil attach -verify) before the TOC signature was checked
+	Bytes large(64 * 1024 * 1024);
+	for(unsigned char &c: large)
+		c = (unsigned char)random();
+	std::string path = write(dir, "large.pkg", makeXar(signer, Signature::CMS, "sha256", large));
+	double single = measure([&] { CHECK_STATUS(verify(path, signer), XarVerifyOK); });
+	double previous = measure([&] {
+		std::ifstream file(path, std::ios::binary | std::ios::ate);
+		Bytes data(size_t(file.tellg()));
+		file.seekg(0).read((char*)data.data(), std::streamsize(data.size()));
+		digest(EVP_sha256(), data);
+		digest(EVP_sha1(), large);
+	});
+	std::printf("64 MiB package: xar_verify_package %.1f ms, read + image checksum + archived checksum %.1f ms\n", single, previous);
+
+	std::filesystem::remove_all(dir);
+	if(failures == 0)
+		std::printf("All xarverify checks passed\n");
+	return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}